@@ -1,9 +1,38 @@
 #include "pybind11/pybind11.h"
-#include "hll.h"
+#include "pybind11/numpy.h"
+#include "hllmatrix.h"
 namespace py = pybind11;
 using namespace sketch;
 using namespace hll;
 
+using U64Array = py::array_t<uint64_t, py::array::c_style | py::array::forcecast>;
+
+// Views of the items of a numpy bytes ('S') array, or of any iterable of str or bytes, so they can be hashed without the GIL.
+// Fixed-width numpy items are viewed in place, stripped of their trailing NULs to match the bytes objects they would convert to.
+// Other items are copied into storage. arr and storage must outlive the returned views.
+static std::vector<hash::byte_span_t> to_spans(py::object items, py::array &arr, std::vector<std::string> &storage) {
+    std::vector<hash::byte_span_t> ret;
+    if(py::isinstance<py::array>(items)) {
+        arr = py::array::ensure(items, py::array::c_style);
+        if(arr && arr.dtype().kind() == 'S') {
+            const size_t itemsize = arr.itemsize();
+            const char *const data = static_cast<const char *>(arr.data());
+            ret.reserve(arr.size());
+            for(size_t i = 0; i < size_t(arr.size()); ++i) {
+                const char *const s = data + i * itemsize;
+                ret.emplace_back(s, ::strnlen(s, itemsize));
+            }
+            return ret;
+        }
+    }
+    for(auto item: items) {
+        if(py::isinstance<py::bytes>(item)) storage.emplace_back(item.cast<std::string>());
+        else                                storage.emplace_back(py::str(item).cast<std::string>());
+    }
+    ret.assign(storage.begin(), storage.end());
+    return ret;
+}
+
 PYBIND11_MODULE(_hll, m) {
     m.doc() = "HyperLogLog"; // optional module docstring
     py::class_<hll_t> (m, "_hll")
@@ -11,15 +40,81 @@ PYBIND11_MODULE(_hll, m) {
         .def(py::init<std::string>())
         .def("clear", &hll_t::clear, "Clear all entries.")
         .def("resize", &hll_t::resize, "Change old size to a new size.")
-        .def("sum", &hll_t::sum, "Add up results.")
-        .def("report", &hll_t::report, "Emit estimated cardinality. Performs sum if not performed, but sum must be recalculated if further entries are added.")
+        .def("sum", &hll_t::sum, "Add up results.", py::call_guard<py::gil_scoped_release>())
+        .def("report", &hll_t::report, "Emit estimated cardinality. Performs sum if not performed, but sum must be recalculated if further entries are added.",
+             py::call_guard<py::gil_scoped_release>())
         .def("add", [](hll_t &h1, uint64_t v) {h1.add(v);}, "Add a (hashed) value to the sketch.")
         .def("addh_", [](hll_t &h1, uint64_t v) {h1.addh(h1.hash(v));}, "Hash an integer value and then add that to the sketch..")
-        .def("jaccard_index", [](hll_t &h1, hll_t &h2) {return jaccard_index(h2, h2);})
+        .def("add_array", [](hll_t &h1, U64Array arr) {
+            const uint64_t *const data = arr.data();
+            const size_t n = arr.size();
+            py::gil_scoped_release release;
+            h1.add_batch(data, n);
+            h1.not_ready();
+        }, "Add an array of (hashed) uint64 values to the sketch without holding the GIL.")
+        .def("addh_array", [](hll_t &h1, U64Array arr) {
+            const uint64_t *const data = arr.data();
+            const size_t n = arr.size();
+            py::gil_scoped_release release;
+            h1.addh_batch(data, n);
+            h1.not_ready();
+        }, "Hash an array of uint64 values and add them to the sketch without holding the GIL.")
+        .def("add_strings", [](hll_t &h1, py::object items) {
+            py::array arr;
+            std::vector<std::string> storage;
+            const std::vector<hash::byte_span_t> spans = to_spans(items, arr, storage);
+            py::gil_scoped_release release;
+            hash::add_strings(h1, spans);
+            h1.not_ready();
+        }, "Hash and add each item of a numpy bytes array or an iterable of str or bytes with XXH3. Numpy arrays are hashed in place. "
+           "Only hashing and insertion release the GIL.")
+        .def("registers", [](const hll_t &h1) {
+            py::array_t<uint8_t> ret(h1.size());
+            std::memcpy(ret.mutable_data(), h1.data(), h1.size());
+            return ret;
+        }, "Copy of the registers as a uint8 numpy array.")
+        .def("jaccard_index", [](hll_t &h1, hll_t &h2) {return jaccard_index(h1, h2);}, py::call_guard<py::gil_scoped_release>())
         .def("sprintf", &hll_t::sprintf)
-        .def("union", [](const hll_t &h1, const hll_t &h2) {return h1 + h2;});
+        .def("union", [](const hll_t &h1, const hll_t &h2) {return h1 + h2;}, py::call_guard<py::gil_scoped_release>());
     m.def("jaccard_index", [](hll_t &h1, hll_t &h2) {
             return jaccard_index(h1, h2);
-        }
+        }, py::call_guard<py::gil_scoped_release>()
+    );
+    m.def("enable_stats", [](bool enabled) {stats::enable(enabled);},
+          "Turn collection of insertion, contention, merge and estimator statistics on or off for every sketch in the process.",
+          py::arg("enabled") = true);
+    m.def("reset_stats", &stats::reset, "Zero all statistics.");
+    m.def("stats", []() {
+            const stats::snapshot_t s = stats::snapshot();
+            py::dict ret;
+            for(unsigned i = 0; i < stats::NUM_COUNTERS; ++i) ret[stats::COUNTER_NAMES[i]] = s.counters[i];
+            ret["ranks"] = py::array_t<uint64_t>(s.ranks.size(), s.ranks.data());
+            ret["update_rate"] = s.update_rate();
+            ret["retry_rate"] = s.retry_rate();
+            return ret;
+        }, "Statistics summed over all threads since the last reset, as a dict of counters, the histogram of inserted ranks, "
+           "the fraction of inserts which changed a register, and failed compare-and-swaps per register update."
+    );
+    m.def("pairwise_jaccard", [](py::sequence sketches, int nthreads, bool square) {
+            std::vector<const hll_t *> ptrs;
+            ptrs.reserve(sketches.size());
+            for(auto item: sketches) ptrs.push_back(&item.cast<const hll_t &>());
+            const size_t n = ptrs.size();
+            py::array_t<float> ret = square ? py::array_t<float>(std::vector<size_t>{n, n})
+                                            : py::array_t<float>(std::vector<size_t>{pairwise_size(n, PAIRWISE_JACCARD_INDEX)});
+            float *const out = ret.mutable_data();
+            {
+                py::gil_scoped_release release;
+                if(square) {
+                    std::vector<float> condensed(pairwise_size(n, PAIRWISE_JACCARD_INDEX));
+                    pairwise_matrix(ptrs.data(), n, condensed.data(), PAIRWISE_JACCARD_INDEX, nthreads);
+                    condensed_to_square(condensed.data(), n, out);
+                } else pairwise_matrix(ptrs.data(), n, out, PAIRWISE_JACCARD_INDEX, nthreads);
+            }
+            return ret;
+        }, "Jaccard indices of all pairs of sketches, computed in parallel without the GIL, as a float32 condensed matrix "
+           "(as in scipy.spatial.distance.squareform) or, if square, the full matrix with ones on the diagonal. "
+           "Sketches must share p. nthreads <= 0 uses every hardware thread.",
+        py::arg("sketches"), py::arg("nthreads") = -1, py::arg("square") = false
     );
 }
@@ -0,0 +1,317 @@
+#ifndef SKETCH_ARCHIVE_H__
+#define SKETCH_ARCHIVE_H__
+#include "hll.h"
+#include "bf.h"
+#include "bbmh.h"
+#include "mh.h"
+#include <exception>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+
+namespace sketch {
+namespace archive {
+
+// Single-file container for many sketches.
+// Layout:
+//   header_t (64 bytes)
+//   Payloads, each starting at a multiple of 64 bytes, holding the raw registers/words of one sketch
+//   Table of contents: one toc_entry_t per sketch, with its type, parameters, payload offset and name
+//   Names, concatenated
+// The table of contents is written last, so sketches can be added one at a time without being held in memory.
+// Archives are memory-mapped for reading, so opening one reads only its table of contents, and a sketch's
+// payload is only touched when it is loaded. Payloads are aligned for SIMD loads directly from the mapping.
+
+enum SketchType: uint32_t {
+    HLL_SKETCH           = 1, // hll::hllbase_t
+    BBIT_MINHASH_SKETCH  = 2, // minhash::FinalBBitMinHash
+    BLOOM_FILTER_SKETCH  = 3, // bf::bfbase_t
+    RANGE_MINHASH_SKETCH = 4  // minhash::FinalRMinHash
+};
+static inline const char *sketch_type_name(uint32_t type) {
+    switch(type) {
+        case HLL_SKETCH:           return "hll";
+        case BBIT_MINHASH_SKETCH:  return "bbit_minhash";
+        case BLOOM_FILTER_SKETCH:  return "bloom_filter";
+        case RANGE_MINHASH_SKETCH: return "range_minhash";
+        default:                   return "unknown";
+    }
+}
+
+static constexpr size_t ALIGNMENT = 64;
+static constexpr uint64_t MAGIC = 0x3130484352414b53ull; // "SKARCH01"
+
+struct header_t {
+    uint64_t magic_;
+    uint64_t nsketches_;
+    uint64_t toc_offset_;
+    uint64_t names_offset_;
+    uint64_t names_size_;
+    uint64_t reserved_[3];
+};
+static_assert(sizeof(header_t) == ALIGNMENT, "Header must fill one aligned block.");
+
+struct toc_entry_t {
+    uint64_t offset_;      // Of the payload, from the start of the file
+    uint64_t size_;        // Of the payload, in bytes
+    uint32_t type_;        // SketchType
+    uint32_t name_size_;
+    uint64_t name_offset_; // From the start of the names
+    uint64_t params_[4];   // Type-specific, see archive_traits
+};
+static_assert(sizeof(toc_entry_t) == 64, "TOC entries should be 64 bytes.");
+
+// Describes how a sketch type is stored: its tag, the parameters needed to rebuild it, and its contiguous payload.
+template<typename T> struct archive_traits;
+
+template<typename HashStruct>
+struct archive_traits<hll::hllbase_t<HashStruct>> {
+    using type = hll::hllbase_t<HashStruct>;
+    static constexpr uint32_t TAG = HLL_SKETCH;
+    static void params(const type &h, uint64_t *params) {
+        params[0] = h.p(); params[1] = h.get_estim(); params[2] = h.get_jestim();
+    }
+    static const void *payload(const type &h) {return h.data();}
+    static size_t payload_size(const type &h) {return h.size();}
+    static type load(const uint64_t *params, const uint8_t *data, size_t size) {
+        type ret(params[0], static_cast<hll::EstimationMethod>(params[1]), static_cast<hll::JointEstimationMethod>(params[2]));
+        if(size != ret.size()) throw std::runtime_error("Payload size does not match hll parameters.");
+        std::memcpy(ret.data(), data, size);
+        return ret;
+    }
+};
+
+template<>
+struct archive_traits<minhash::FinalBBitMinHash> {
+    using type = minhash::FinalBBitMinHash;
+    static constexpr uint32_t TAG = BBIT_MINHASH_SKETCH;
+    static void params(const type &h, uint64_t *params) {
+        params[0] = h.p_; params[1] = h.b_;
+        std::memcpy(&params[2], &h.est_cardinality_, sizeof(double));
+    }
+    static const void *payload(const type &h) {return h.core_.data();}
+    static size_t payload_size(const type &h) {return h.core_.size() * sizeof(h.core_[0]);}
+    static type load(const uint64_t *params, const uint8_t *data, size_t size) {
+        double est;
+        std::memcpy(&est, &params[2], sizeof(est));
+        type ret(params[0], params[1], est);
+        if(size != payload_size(ret)) throw std::runtime_error("Payload size does not match b-bit minhash parameters.");
+        std::memcpy(ret.core_.data(), data, size);
+        return ret;
+    }
+};
+
+template<typename HashStruct, bool Blocked>
+struct archive_traits<bf::bfbase_t<HashStruct, Blocked>> {
+    using type = bf::bfbase_t<HashStruct, Blocked>;
+    static constexpr uint32_t TAG = BLOOM_FILTER_SKETCH;
+    // Seeds are regenerated from the seed seed, as the filter's constructor does.
+    // Blocked filters are recorded with 0 hashes, as in their serialized form.
+    static void params(const type &h, uint64_t *params) {
+        params[0] = h.p(); params[1] = Blocked ? 0: h.nhashes(); params[2] = h.seedseed();
+    }
+    static const void *payload(const type &h) {return h.data();}
+    static size_t payload_size(const type &h) {return h.core().size() * sizeof(uint64_t);}
+    static type load(const uint64_t *params, const uint8_t *data, size_t size) {
+        if((params[1] == 0) != Blocked) throw std::runtime_error("Bloom filter in archive is of the other mode (blocked or standard).");
+        type ret(params[0], params[1], params[2]);
+        if(size != payload_size(ret)) throw std::runtime_error("Payload size does not match bloom filter parameters.");
+        std::memcpy(ret.data(), data, size);
+        return ret;
+    }
+};
+
+template<typename T, typename Cmp, typename Allocator>
+struct archive_traits<minhash::FinalRMinHash<T, Cmp, Allocator>> {
+    using type = minhash::FinalRMinHash<T, Cmp, Allocator>;
+    static constexpr uint32_t TAG = RANGE_MINHASH_SKETCH;
+    static void params(const type &h, uint64_t *params) {
+        params[0] = sizeof(T); params[1] = h.size();
+    }
+    static const void *payload(const type &h) {return h.first.data();}
+    static size_t payload_size(const type &h) {return h.size() * sizeof(T);}
+    static type load(const uint64_t *params, const uint8_t *data, size_t size) {
+        if(params[0] != sizeof(T) || size != params[1] * sizeof(T))
+            throw std::runtime_error("Payload does not match range minhash parameters.");
+        std::vector<T, Allocator> first(params[1]);
+        std::memcpy(first.data(), data, size);
+        return type(std::move(first));
+    }
+};
+
+class archive_writer_t {
+    int                        fd_;
+    uint64_t                  pos_;
+    std::vector<toc_entry_t>  toc_;
+    std::string             names_;
+    void write_at(const void *data, size_t size, uint64_t offset) {
+        for(const uint8_t *p = static_cast<const uint8_t *>(data); size;) {
+            const ssize_t rc = ::pwrite(fd_, p, size, offset);
+            if(rc <= 0) throw std::runtime_error(std::string("Failed to write to archive in ") + __PRETTY_FUNCTION__);
+            p += rc; offset += rc; size -= rc;
+        }
+    }
+public:
+    explicit archive_writer_t(const char *path): pos_(sizeof(header_t)) {
+        fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd_ < 0) throw std::runtime_error(std::string("Could not open file at ") + path);
+    }
+    explicit archive_writer_t(const std::string &path): archive_writer_t(path.data()) {}
+    archive_writer_t(const archive_writer_t &) = delete;
+    archive_writer_t &operator=(const archive_writer_t &) = delete;
+    ~archive_writer_t() {
+        if(fd_ >= 0) {
+            try {close();} catch(...) {}
+        }
+    }
+    template<typename SketchType>
+    void add(const std::string &name, const SketchType &sketch) {
+        using traits = archive_traits<SketchType>;
+        if(fd_ < 0) throw std::runtime_error("Archive has already been closed.");
+        toc_entry_t entry{};
+        entry.offset_ = pos_;
+        entry.size_ = traits::payload_size(sketch);
+        entry.type_ = traits::TAG;
+        entry.name_size_ = name.size();
+        entry.name_offset_ = names_.size();
+        traits::params(sketch, entry.params_);
+        write_at(traits::payload(sketch), entry.size_, pos_);
+        pos_ = (pos_ + entry.size_ + ALIGNMENT - 1) & ~uint64_t(ALIGNMENT - 1);
+        names_ += name;
+        toc_.push_back(entry);
+    }
+    size_t size() const {return toc_.size();}
+    // Writes the table of contents and header. Called by the destructor if needed.
+    void close() {
+        if(fd_ < 0) return;
+        const header_t header{MAGIC, toc_.size(), pos_, pos_ + toc_.size() * sizeof(toc_entry_t), names_.size(), {0}};
+        write_at(toc_.data(), toc_.size() * sizeof(toc_entry_t), header.toc_offset_);
+        write_at(names_.data(), names_.size(), header.names_offset_);
+        write_at(&header, sizeof(header), 0);
+        const int fd = fd_;
+        fd_ = -1;
+        if(::close(fd)) throw std::runtime_error("Failed to close archive.");
+    }
+};
+
+class archive_t {
+    const uint8_t                          *data_;
+    size_t                                  size_;
+    const toc_entry_t                       *toc_;
+    const char                            *names_;
+    uint64_t                           nsketches_;
+    std::unordered_map<std::string, size_t> index_;
+
+    template<typename SketchType>
+    struct load_data_t {
+        const archive_t                          &archive_;
+        const size_t                             *indices_;
+        std::vector<std::unique_ptr<SketchType>> &out_;
+        std::vector<std::exception_ptr>       &errors_;
+    };
+    template<typename SketchType>
+    static void load_helper(void *data_, long i, int tid) {
+        auto &data(*reinterpret_cast<load_data_t<SketchType> *>(data_));
+        // An exception escaping a kt_for worker would terminate the program, so it is rethrown by load on the calling thread.
+        try {
+            data.out_[i].reset(new SketchType(data.archive_.template get<SketchType>(data.indices_[i])));
+        } catch(...) {
+            data.errors_[i] = std::current_exception();
+        }
+    }
+public:
+    explicit archive_t(const char *path) {
+        const int fd = ::open(path, O_RDONLY);
+        if(fd < 0) throw std::runtime_error(std::string("Could not open file at ") + path);
+        struct stat st;
+        if(::fstat(fd, &st)) {
+            ::close(fd);
+            throw std::runtime_error(std::string("Could not stat file at ") + path);
+        }
+        size_ = st.st_size;
+        void *const map = size_ >= sizeof(header_t) ? ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0): MAP_FAILED;
+        ::close(fd);
+        if(map == MAP_FAILED) throw std::runtime_error(std::string("Could not map archive at ") + path);
+        data_ = static_cast<const uint8_t *>(map);
+        ::madvise(map, size_, MADV_RANDOM);
+        header_t header;
+        std::memcpy(&header, data_, sizeof(header));
+        if(header.magic_ != MAGIC || header.toc_offset_ % ALIGNMENT || header.toc_offset_ + header.nsketches_ * sizeof(toc_entry_t) != header.names_offset_
+           || header.names_offset_ + header.names_size_ != size_) {
+            ::munmap(map, size_);
+            throw std::runtime_error(std::string("Invalid or truncated archive at ") + path);
+        }
+        nsketches_ = header.nsketches_;
+        toc_ = reinterpret_cast<const toc_entry_t *>(data_ + header.toc_offset_);
+        names_ = reinterpret_cast<const char *>(data_ + header.names_offset_);
+        index_.reserve(nsketches_);
+        for(size_t i = 0; i < nsketches_; ++i) {
+            const toc_entry_t &e = toc_[i];
+            if(e.offset_ % ALIGNMENT || e.offset_ + e.size_ > header.toc_offset_ || e.name_offset_ + e.name_size_ > header.names_size_) {
+                ::munmap(map, size_);
+                throw std::runtime_error(std::string("Invalid table of contents entry ") + std::to_string(i) + " in archive at " + path);
+            }
+            index_.emplace(name(i), i);
+        }
+    }
+    explicit archive_t(const std::string &path): archive_t(path.data()) {}
+    archive_t(const archive_t &) = delete;
+    archive_t &operator=(const archive_t &) = delete;
+    ~archive_t() {::munmap(const_cast<uint8_t *>(data_), size_);}
+
+    size_t size() const {return nsketches_;}
+    std::string name(size_t i) const {return std::string(names_ + toc_[i].name_offset_, toc_[i].name_size_);}
+    uint32_t type(size_t i) const {return toc_[i].type_;}
+    const uint64_t *params(size_t i) const {return toc_[i].params_;}
+    // Raw payload of sketch i, aligned to ALIGNMENT bytes, e.g. an hll's registers.
+    const uint8_t *payload(size_t i) const {return data_ + toc_[i].offset_;}
+    size_t payload_size(size_t i) const {return toc_[i].size_;}
+    bool contains(const std::string &name) const {return index_.find(name) != index_.end();}
+    size_t index(const std::string &name) const {
+        auto it = index_.find(name);
+        if(it == index_.end()) throw std::runtime_error(std::string("No sketch named ") + name + " in archive.");
+        return it->second;
+    }
+
+    template<typename SketchType>
+    SketchType get(size_t i) const {
+        using traits = archive_traits<SketchType>;
+        if(i >= nsketches_) throw std::out_of_range(std::string("Sketch index ") + std::to_string(i) + " out of range");
+        if(toc_[i].type_ != traits::TAG)
+            throw std::runtime_error(std::string("Sketch ") + std::to_string(i) + " is a " + sketch_type_name(toc_[i].type_) + ", not a " + sketch_type_name(traits::TAG));
+        return traits::load(toc_[i].params_, payload(i), toc_[i].size_);
+    }
+    template<typename SketchType>
+    SketchType get(const std::string &name) const {return get<SketchType>(index(name));}
+
+    // Loads the sketches at indices, decoding them in parallel.
+    template<typename SketchType>
+    std::vector<SketchType> load(const std::vector<size_t> &indices, int nthreads=-1) const {
+        if(nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+        for(const size_t i: indices) // Fail fast, before decoding anything.
+            if(i >= nsketches_ || toc_[i].type_ != archive_traits<SketchType>::TAG)
+                throw std::runtime_error(std::string("Sketch ") + std::to_string(i) + " is missing or not a " + sketch_type_name(archive_traits<SketchType>::TAG));
+        std::vector<std::unique_ptr<SketchType>> tmp(indices.size());
+        std::vector<std::exception_ptr> errors(indices.size());
+        load_data_t<SketchType> data{*this, indices.data(), tmp, errors};
+        kt_for(nthreads, load_helper<SketchType>, &data, indices.size());
+        for(const auto &e: errors) if(e) std::rethrow_exception(e);
+        std::vector<SketchType> ret;
+        ret.reserve(indices.size());
+        for(auto &ptr: tmp) ret.emplace_back(std::move(*ptr));
+        return ret;
+    }
+    // Loads every sketch, which must all be of type SketchType.
+    template<typename SketchType>
+    std::vector<SketchType> load(int nthreads=-1) const {
+        std::vector<size_t> indices(nsketches_);
+        std::iota(indices.begin(), indices.end(), size_t(0));
+        return load<SketchType>(indices, nthreads);
+    }
+};
+
+} // namespace archive
+} // namespace sketch
+
+#endif /* SKETCH_ARCHIVE_H__ */
@@ -0,0 +1,342 @@
+#include "hll.h"
+#include "bf.h"
+#include "ccm.h"
+#include "mh.h"
+#include "bbmh.h"
+#include "aesctr/wy.h"
+#include <chrono>
+#include <cinttypes>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+/*
+ * Throughput benchmark suite.
+ * For each structure and size, measures:
+ *     insert:    elements inserted per second, with each of nthreads threads filling its own sketch from its share of the input
+ *     query:     queries per second (the structure's natural query: point queries for filters and counters,
+ *                similarity comparisons for MinHash variants, cardinality estimates for HyperLogLogs), per thread as above
+ *     merge:     merges per second of two full sketches, single-threaded
+ *     serialize: gzip-compressed writes per second, single-threaded, with the size written
+ * Rows are emitted as CSV or JSON so that results can be compared across releases and machines.
+ * Operations a structure does not support are omitted.
+ */
+
+struct record_t {
+    std::string structure, param, op;
+    uint64_t size;
+    unsigned nthreads;
+    uint64_t nops;
+    double seconds;
+    uint64_t bytes;
+};
+
+template<typename F>
+double seconds(const F &func) {
+    auto start = clk::now();
+    func();
+    return std::chrono::duration<double>(clk::now() - start).count();
+}
+
+// Each adapter provides name(), param(), sizes(), make(size), insert, query (returning a value which keeps the work observable),
+// nqueries(size, nelem), merge and serialize, the last two returning false if unsupported.
+struct HllBench {
+    using sketch_type = hll::hll_t;
+    static const char *name() {return "hll_t";}
+    static const char *param() {return "p";}
+    static std::vector<unsigned> sizes() {return {10, 14, 18};}
+    static sketch_type make(unsigned p) {return sketch_type(p);}
+    static void insert(sketch_type &s, const uint64_t *v, size_t n) {s.addh_batch(v, n);}
+    static size_t nqueries(unsigned p, size_t) {return size_t(1) << std::max(4, 24 - int(p));}
+    static double query(sketch_type &s, const sketch_type &, const uint64_t *, size_t n) {
+        double ret = 0;
+        for(size_t i = 0; i < n; ++i) s.not_ready(), ret += s.report();
+        return ret;
+    }
+    static bool merge(sketch_type &a, const sketch_type &b) {a += b; return true;}
+    static bool serialize(const sketch_type &s, gzFile fp) {s.write(fp); return true;}
+};
+
+template<bool Blocked>
+struct BfBenchBase {
+    using sketch_type = bf::bfbase_t<hash::WangHash, Blocked>;
+    static const char *name() {return Blocked ? "sbf_t": "bf_t";}
+    static const char *param() {return "l2sz";}
+    static std::vector<unsigned> sizes() {return {16, 20, 24, 28};}
+    static sketch_type make(unsigned l2sz) {return sketch_type(l2sz, 4, 137);}
+    static void insert(sketch_type &s, const uint64_t *v, size_t n) {for(size_t i = 0; i < n; s.addh(v[i++]));}
+    static size_t nqueries(unsigned, size_t nelem) {return nelem;}
+    static double query(sketch_type &s, const sketch_type &, const uint64_t *v, size_t n) {
+        size_t ret = 0;
+        for(size_t i = 0; i < n; ret += s.may_contain(v[i++]));
+        return ret;
+    }
+    static bool merge(sketch_type &a, const sketch_type &b) {a |= b; return true;}
+    static bool serialize(const sketch_type &s, gzFile fp) {s.write(fp); return true;}
+};
+using BfBench = BfBenchBase<false>;
+using SbfBench = BfBenchBase<true>;
+
+struct CcmBench {
+    using sketch_type = cm::ccm_t;
+    static const char *name() {return "ccm_t";}
+    static const char *param() {return "l2sz";}
+    static std::vector<unsigned> sizes() {return {12, 16, 20};}
+    static sketch_type make(unsigned l2sz) {return sketch_type(16, l2sz, 4);}
+    static void insert(sketch_type &s, const uint64_t *v, size_t n) {for(size_t i = 0; i < n; s.addh(v[i++]));}
+    static size_t nqueries(unsigned, size_t nelem) {return nelem;}
+    static double query(sketch_type &s, const sketch_type &, const uint64_t *v, size_t n) {
+        double ret = 0;
+        for(size_t i = 0; i < n; ret += s.est_count(v[i++]));
+        return ret;
+    }
+    static bool merge(sketch_type &a, const sketch_type &b) {a += b; return true;}
+    static bool serialize(const sketch_type &, gzFile) {return false;}
+};
+
+struct CsBench {
+    using sketch_type = cm::cs_t;
+    static const char *name() {return "cs_t";}
+    static const char *param() {return "l2sz";}
+    static std::vector<unsigned> sizes() {return {12, 16, 20};}
+    static sketch_type make(unsigned l2sz) {return sketch_type(l2sz, 4);}
+    static void insert(sketch_type &s, const uint64_t *v, size_t n) {for(size_t i = 0; i < n; s.addh(v[i++]));}
+    static size_t nqueries(unsigned, size_t nelem) {return nelem;}
+    static double query(sketch_type &s, const sketch_type &, const uint64_t *v, size_t n) {
+        double ret = 0;
+        for(size_t i = 0; i < n; ret += s.est_count(v[i++]));
+        return ret;
+    }
+    static bool merge(sketch_type &a, const sketch_type &b) {a += b; return true;}
+    static bool serialize(const sketch_type &, gzFile) {return false;}
+};
+
+struct RangeMinHashBench {
+    using sketch_type = minhash::RangeMinHash<uint64_t>;
+    static const char *name() {return "RangeMinHash";}
+    static const char *param() {return "k";}
+    static std::vector<unsigned> sizes() {return {128, 1024, 8192};}
+    static sketch_type make(unsigned k) {return sketch_type(k);}
+    static void insert(sketch_type &s, const uint64_t *v, size_t n) {for(size_t i = 0; i < n; s.addh(v[i++]));}
+    static size_t nqueries(unsigned k, size_t) {return (size_t(1) << 24) / k;}
+    static double query(sketch_type &s, const sketch_type &ref, const uint64_t *, size_t n) {
+        const auto f1 = s.finalize(), f2 = ref.finalize();
+        double ret = 0;
+        for(size_t i = 0; i < n; ret += f1.jaccard_index(f2), ++i);
+        return ret;
+    }
+    static bool merge(sketch_type &a, const sketch_type &b) {a += b; return true;}
+    static bool serialize(const sketch_type &s, gzFile fp) {s.write(fp); return true;}
+};
+
+struct BBitMinHashBench {
+    using sketch_type = minhash::BBitMinHasher<uint64_t>;
+    static const char *name() {return "BBitMinHasher";}
+    static const char *param() {return "p";}
+    static std::vector<unsigned> sizes() {return {8, 12, 16};}
+    static sketch_type make(unsigned p) {return sketch_type(p, 16);}
+    static void insert(sketch_type &s, const uint64_t *v, size_t n) {for(size_t i = 0; i < n; s.addh(v[i++]));}
+    static size_t nqueries(unsigned p, size_t) {return size_t(1) << std::max(4, 26 - int(p));}
+    static double query(sketch_type &s, const sketch_type &ref, const uint64_t *, size_t n) {
+        const auto f1 = s.finalize(), f2 = ref.finalize();
+        double ret = 0;
+        for(size_t i = 0; i < n; ret += f1.jaccard_index(f2), ++i);
+        return ret;
+    }
+    static bool merge(sketch_type &a, const sketch_type &b) {a += b; return true;}
+    static bool serialize(const sketch_type &s, gzFile fp) {s.write(fp); return true;}
+};
+
+struct SuperMinHashBench {
+    using sketch_type = minhash::SuperMinHash<>;
+    static const char *name() {return "SuperMinHash";}
+    static const char *param() {return "m";}
+    static std::vector<unsigned> sizes() {return {256, 4096, 16384};}
+    static sketch_type make(unsigned m) {return sketch_type(m);}
+    static void insert(sketch_type &s, const uint64_t *v, size_t n) {for(size_t i = 0; i < n; s.addh(v[i++]));}
+    static size_t nqueries(unsigned m, size_t) {return (size_t(1) << 26) / m;}
+    static double query(sketch_type &s, const sketch_type &ref, const uint64_t *, size_t n) {
+        const auto f1 = s.finalize(), f2 = ref.finalize();
+        double ret = 0;
+        for(size_t i = 0; i < n; ret += f1.jaccard_index(f2), ++i);
+        return ret;
+    }
+    static bool merge(sketch_type &, const sketch_type &) {return false;}
+    static bool serialize(const sketch_type &s, gzFile fp) {s.write(fp); return true;}
+};
+
+struct HyperMinHashBench {
+    using sketch_type = minhash::HyperMinHash<>;
+    static const char *name() {return "HyperMinHash";}
+    static const char *param() {return "p";}
+    static std::vector<unsigned> sizes() {return {10, 14, 18};}
+    static sketch_type make(unsigned p) {return sketch_type(p, 10);}
+    static void insert(sketch_type &s, const uint64_t *v, size_t n) {for(size_t i = 0; i < n; s.addh(v[i++]));}
+    static size_t nqueries(unsigned p, size_t) {return size_t(1) << std::max(2, 16 - int(p));}
+    static double query(sketch_type &s, const sketch_type &ref, const uint64_t *, size_t n) {
+        double ret = 0;
+        for(size_t i = 0; i < n; ret += s.jaccard_index(ref), ++i);
+        return ret;
+    }
+    static bool merge(sketch_type &a, const sketch_type &b) {a += b; return true;}
+    static bool serialize(const sketch_type &s, gzFile fp) {s.write(fp); return true;}
+};
+
+struct options_t {
+    std::vector<uint64_t> vals;      // Inserted elements
+    std::vector<uint64_t> queries;   // Point queries, half of which were inserted
+    std::vector<unsigned> threads;
+    unsigned reps;
+    std::string tmppath;
+};
+
+template<typename T>
+void run_parallel(unsigned nthreads, const T &func) {
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads);
+    for(unsigned tid = 0; tid < nthreads; ++tid) threads.emplace_back(func, tid);
+    for(auto &t: threads) t.join();
+}
+
+volatile double sink;
+
+template<typename B>
+void bench(const options_t &opts, std::vector<record_t> &out) {
+    using S = typename B::sketch_type;
+    const size_t n = opts.vals.size();
+    for(const unsigned size: B::sizes()) {
+        const std::string name(B::name()), param = std::string(B::param()) + '=' + std::to_string(size);
+        S ref = B::make(size);
+        B::insert(ref, opts.queries.data(), opts.queries.size());
+        for(const unsigned nthreads: opts.threads) {
+            std::vector<S> sketches;
+            for(unsigned i = 0; i < nthreads; ++i) sketches.emplace_back(B::make(size));
+            const size_t per_thread = (n + nthreads - 1) / nthreads;
+            const double t = seconds([&]() {
+                run_parallel(nthreads, [&](unsigned tid) {
+                    const size_t start = std::min(n, tid * per_thread);
+                    B::insert(sketches[tid], opts.vals.data() + start, std::min(n, start + per_thread) - start);
+                });
+            });
+            out.push_back(record_t{name, param, "insert", size, nthreads, n, t, 0});
+            const size_t nq = std::min(B::nqueries(size, n), opts.queries.size());
+            std::vector<double> results(nthreads);
+            const double qt = seconds([&]() {
+                run_parallel(nthreads, [&](unsigned tid) {results[tid] = B::query(sketches[tid], ref, opts.queries.data(), nq);});
+            });
+            for(const double r: results) sink = sink + r;
+            out.push_back(record_t{name, param, "query", size, nthreads, nq * nthreads, qt, 0});
+        }
+        // Single-threaded merge and serialization of full sketches
+        S full = B::make(size);
+        B::insert(full, opts.vals.data(), n);
+        S acc(full);
+        if(B::merge(acc, ref)) {
+            const double mt = seconds([&]() {for(unsigned i = 0; i < opts.reps; ++i) B::merge(acc, ref);});
+            out.push_back(record_t{name, param, "merge", size, 1, opts.reps, mt, 0});
+        }
+        gzFile fp = gzopen(opts.tmppath.data(), "wb");
+        if(fp == nullptr) throw std::runtime_error(std::string("Could not open file at ") + opts.tmppath);
+        bool supported = true;
+        const double st = seconds([&]() {for(unsigned i = 0; i < opts.reps && supported; ++i) supported = B::serialize(full, fp);});
+        gzclose(fp);
+        if(supported) {
+            struct stat st_buf;
+            const uint64_t bytes = ::stat(opts.tmppath.data(), &st_buf) ? 0: uint64_t(st_buf.st_size) / opts.reps;
+            out.push_back(record_t{name, param, "serialize", size, 1, opts.reps, st, bytes});
+        }
+        std::remove(opts.tmppath.data());
+    }
+}
+
+void emit(std::FILE *fp, const std::vector<record_t> &records, bool json) {
+    if(json) std::fputs("[\n", fp);
+    else     std::fputs("structure,param,size,op,nthreads,nops,seconds,ops_per_sec,bytes\n", fp);
+    for(size_t i = 0; i < records.size(); ++i) {
+        const auto &r = records[i];
+        if(json)
+            std::fprintf(fp, "  {\"structure\": \"%s\", \"param\": \"%s\", \"size\": %" PRIu64 ", \"op\": \"%s\", \"nthreads\": %u, "
+                             "\"nops\": %" PRIu64 ", \"seconds\": %.9g, \"ops_per_sec\": %.9g, \"bytes\": %" PRIu64 "}%s\n",
+                         r.structure.data(), r.param.data(), r.size, r.op.data(), r.nthreads, r.nops, r.seconds, r.nops / r.seconds, r.bytes,
+                         i + 1 == records.size() ? "": ",");
+        else
+            std::fprintf(fp, "%s,%s,%" PRIu64 ",%s,%u,%" PRIu64 ",%.9g,%.9g,%" PRIu64 "\n",
+                         r.structure.data(), r.param.data(), r.size, r.op.data(), r.nthreads, r.nops, r.seconds, r.nops / r.seconds, r.bytes);
+    }
+    if(json) std::fputs("]\n", fp);
+}
+
+std::vector<std::string> split(const char *s) {
+    std::vector<std::string> ret;
+    for(const char *p; (p = std::strchr(s, ',')) != nullptr; s = p + 1) ret.emplace_back(s, p);
+    ret.emplace_back(s);
+    return ret;
+}
+
+void usage(const char *arg) {
+    std::fprintf(stderr, "%s [flags]\n"
+                         "-s\tComma-separated structures to benchmark: hll, bf, sbf, ccm, cs, rmh, bbmh, smh, hmh or all [all]\n"
+                         "-f\tOutput format: csv or json [csv]\n"
+                         "-o\tOutput path [stdout]\n"
+                         "-n\tNumber of elements to insert [1 << 22]\n"
+                         "-t\tComma-separated thread counts [1,2,4,... up to the number of hardware threads]\n"
+                         "-r\tRepetitions of merge and serialize [16]\n",
+                 arg);
+}
+
+int main(int argc, char *argv[]) {
+    std::string structures = "all", format = "csv", outpath;
+    size_t nelem = size_t(1) << 22;
+    options_t opts;
+    opts.reps = 16;
+    for(int c; (c = getopt(argc, argv, "s:f:o:n:t:r:h")) >= 0;) {
+        switch(c) {
+            case 's': structures = optarg; break;
+            case 'f': format = optarg; break;
+            case 'o': outpath = optarg; break;
+            case 'n': nelem = std::strtoull(optarg, nullptr, 10); break;
+            case 't': for(const auto &t: split(optarg)) opts.threads.push_back(std::max(1, std::atoi(t.data()))); break;
+            case 'r': opts.reps = std::max(1, std::atoi(optarg)); break;
+            case 'h': default: usage(*argv); return EXIT_FAILURE;
+        }
+    }
+    if(format != "csv" && format != "json") {
+        usage(*argv);
+        return EXIT_FAILURE;
+    }
+    if(opts.threads.empty())
+        for(unsigned t = 1, nt = std::max(1u, std::thread::hardware_concurrency()); t <= nt; t = t < nt && t * 2 > nt ? nt: t * 2)
+            opts.threads.push_back(t);
+    wy::WyHash<uint64_t> gen(1337);
+    opts.vals.resize(nelem);
+    for(auto &v: opts.vals) v = gen();
+    opts.queries.resize(std::min(nelem, size_t(1) << 20));
+    for(size_t i = 0; i < opts.queries.size(); ++i) opts.queries[i] = i & 1 ? opts.vals[i]: gen();
+    opts.tmppath = "benchsuite." + std::to_string(::getpid()) + ".tmp";
+
+    std::vector<record_t> records;
+    for(const auto &s: split(structures.data())) {
+        const bool all = s == "all";
+        if(all || s == "hll")  bench<HllBench>(opts, records);
+        if(all || s == "bf")   bench<BfBench>(opts, records);
+        if(all || s == "sbf")  bench<SbfBench>(opts, records);
+        if(all || s == "ccm")  bench<CcmBench>(opts, records);
+        if(all || s == "cs")   bench<CsBench>(opts, records);
+        if(all || s == "rmh")  bench<RangeMinHashBench>(opts, records);
+        if(all || s == "bbmh") bench<BBitMinHashBench>(opts, records);
+        if(all || s == "smh")  bench<SuperMinHashBench>(opts, records);
+        if(all || s == "hmh")  bench<HyperMinHashBench>(opts, records);
+        if(!all && s != "hll" && s != "bf" && s != "sbf" && s != "ccm" && s != "cs" && s != "rmh" && s != "bbmh" && s != "smh" && s != "hmh") {
+            std::fprintf(stderr, "Unknown structure %s\n", s.data());
+            usage(*argv);
+            return EXIT_FAILURE;
+        }
+    }
+    std::FILE *ofp = outpath.empty() ? stdout: std::fopen(outpath.data(), "w");
+    if(ofp == nullptr) throw std::runtime_error(std::string("Could not open file at ") + outpath);
+    emit(ofp, records, format == "json");
+    if(ofp != stdout) std::fclose(ofp);
+}
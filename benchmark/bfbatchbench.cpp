@@ -0,0 +1,53 @@
+#include "bf.h"
+#include "aesctr/wy.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+template<typename F>
+double seconds(const F &func) {
+    auto start = clk::now();
+    func();
+    return std::chrono::duration<double>(clk::now() - start).count();
+}
+
+template<typename Filter>
+void run(const char *name, unsigned l2sz, unsigned nh, const std::vector<uint64_t> &vals, const std::vector<uint64_t> &queries) {
+    const size_t n = vals.size();
+    Filter f1(l2sz, nh, 137), f2(l2sz, nh, 137);
+    const double insert_time = seconds([&]() {for(const auto v: vals) f1.addh(v);});
+    const double batch_insert_time = seconds([&]() {f2.addh_batch(vals);});
+    if(f1.core() != f2.core()) std::fprintf(stderr, "Filters differ after batch insertion\n");
+    std::vector<uint64_t> bitmap((n + 63) / 64);
+    size_t hits = 0;
+    const double query_time = seconds([&]() {
+        for(size_t i = 0; i < n; ++i) bitmap[i >> 6] = (bitmap[i >> 6] & ~(uint64_t(1) << (i & 63))) | uint64_t(f1.may_contain(queries[i])) << (i & 63);
+    });
+    for(const auto w: bitmap) hits += common::popcount(w);
+    const double batch_query_time = seconds([&]() {f1.may_contain(queries.data(), n, bitmap.data());});
+    for(const auto w: bitmap) hits -= common::popcount(w);
+    if(hits) std::fprintf(stderr, "Batch and single queries differ\n");
+    std::fprintf(stdout, "%s\t%u\t%u\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\n", name, l2sz, unsigned(f1.nhashes()),
+                 n / insert_time * 1e-6, n / batch_insert_time * 1e-6, insert_time / batch_insert_time,
+                 n / query_time * 1e-6, n / batch_query_time * 1e-6, query_time / batch_query_time);
+}
+
+/*
+ * Compares one-key-at-a-time insertion and queries against the pipelined, prefetched addh_batch and batch may_contain,
+ * for standard and split-block filters from cache-resident to much larger than cache.
+ * Usage: bfbatchbench [nkeys=1<<22] [nhashes=4]
+ */
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): size_t(1) << 22;
+    const unsigned nh = argc > 2 ? std::atoi(argv[2]): 4;
+    wy::WyHash<uint64_t> gen(1337);
+    std::vector<uint64_t> vals(n), queries(n);
+    for(auto &v: vals) v = gen();
+    for(size_t i = 0; i < n; ++i) queries[i] = i & 1 ? vals[i]: gen();
+    std::fprintf(stdout, "#filter\tl2sz\tnhashes\tinsert_mops\tbatch_insert_mops\tinsert_speedup\tquery_mops\tbatch_query_mops\tquery_speedup\n");
+    for(const unsigned l2sz: {20, 24, 26, 28, 32}) {
+        run<bf::bf_t>("bf_t", l2sz, nh, vals, queries);
+        run<bf::sbf_t>("sbf_t", l2sz, nh, vals, queries);
+    }
+}
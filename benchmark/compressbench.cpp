@@ -0,0 +1,57 @@
+#include "hll.h"
+#include "aesctr/wy.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+template<typename F>
+double seconds(const F &func) {
+    auto start = clk::now();
+    func();
+    return std::chrono::duration<double>(clk::now() - start).count();
+}
+
+// The previous compress(): allocates a new sketch and scans each group of registers a byte at a time.
+hll::hll_t scalar_compress(const hll::hll_t &h, unsigned new_np) {
+    hll::hll_t ret(new_np, h.get_estim(), h.get_jestim());
+    const unsigned d = h.p() - new_np;
+    const size_t ratio = size_t(1) << d;
+    for(size_t i = 0, b = 0; i < ret.size(); ++i, b += ratio) {
+        size_t j = 0;
+        while(j < ratio && h.core()[j + b] == 0) ++j;
+        if(j != ratio) ret.data()[i] = j ? d - common::ilog2(j): h.core()[b] + d;
+    }
+    return ret;
+}
+
+/*
+ * Compares the previous scalar, allocating compress against SIMD compress(), compress_inplace() and the parallel batch
+ * compress_inplace(), reducing nsketches sketches from p to each smaller precision.
+ * Usage: compressbench [p=20] [nsketches=64] [nthreads=hardware concurrency]
+ */
+int main(int argc, char *argv[]) {
+    const unsigned p = argc > 1 ? std::atoi(argv[1]): 20;
+    const size_t nsketches = argc > 2 ? std::strtoull(argv[2], nullptr, 10): 64;
+    const int nthreads = argc > 3 ? std::atoi(argv[3]): int(std::thread::hardware_concurrency());
+    wy::WyHash<uint64_t> gen(1337);
+    std::vector<hll::hll_t> sketches;
+    for(size_t i = 0; i < nsketches; ++i) {
+        sketches.emplace_back(p);
+        // Sketches of widely varying cardinality, so that groups of empty registers are common in some.
+        for(size_t j = 0, n = size_t(1) << (8 + i % 16); j < n; ++j) sketches.back().add(gen());
+    }
+    std::fprintf(stdout, "#p\tnew_p\tscalar_s\tsimd_s\tinplace_s\tbatch_s\tsimd_speedup\tinplace_speedup\tbatch_speedup\n");
+    for(unsigned new_p = p - 1; new_p + 10 >= p && new_p >= 4; --new_p) {
+        std::vector<hll::hll_t> scalar, simd, copies(sketches);
+        const double scalar_time = seconds([&]() {for(const auto &h: sketches) scalar.push_back(scalar_compress(h, new_p));});
+        const double simd_time = seconds([&]() {for(const auto &h: sketches) simd.push_back(h.compress(new_p));});
+        const double inplace_time = seconds([&]() {for(auto &h: copies) h.compress_inplace(new_p);});
+        copies = sketches;
+        const double batch_time = seconds([&]() {hll::compress_inplace(copies, new_p, nthreads);});
+        for(size_t i = 0; i < nsketches; ++i)
+            if(!(scalar[i] == simd[i]) || !(scalar[i] == copies[i])) std::fprintf(stderr, "Compressed sketches differ at new_p = %u\n", new_p);
+        std::fprintf(stdout, "%u\t%u\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\n", p, new_p, scalar_time, simd_time, inplace_time, batch_time,
+                     scalar_time / simd_time, scalar_time / inplace_time, scalar_time / batch_time);
+    }
+}
@@ -0,0 +1,50 @@
+#include "hll.h"
+#include "aesctr/wy.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+template<typename F>
+double time_reps(size_t nreps, const F &func) {
+    auto start = clk::now();
+    for(size_t i = 0; i < nreps; ++i) func();
+    return std::chrono::duration<double>(clk::now() - start).count() / nreps;
+}
+
+/*
+ * Compares the scalar per-byte histogram accumulation formerly used by ertl_joint (joint_unroller)
+ * against the SIMD key-byte kernel (joint_histogram_t), and reports full ertl_joint and union_size times.
+ * Usage: jointbench [nreps=16]
+ */
+int main(int argc, char *argv[]) {
+    const size_t nreps = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 16;
+    wy::WyHash<uint64_t> gen(1337);
+    std::fprintf(stdout, "#p\tunroller_GBps\tkernel_GBps\tertl_joint_GBps\tunion_size_GBps\tspeedup\n");
+    for(unsigned p = 10; p <= 24; p += 2) {
+        hll::hll_t h1(p, hll::ERTL_MLE, hll::ERTL_JOINT_MLE), h2(p, hll::ERTL_MLE, hll::ERTL_JOINT_MLE);
+        for(size_t i = 0, n = size_t(4) << p; i < n; ++i) {
+            const uint64_t v = gen();
+            h1.add(v);
+            h2.add(i & 1 ? v: gen());
+        }
+        h1.csum(); h2.csum();
+        const double bytes = 2. * h1.size();
+        std::array<uint32_t, 64> c1, c2, cu, ceq, cg1, cg2;
+        const double unroller_time = time_reps(nreps, [&]() {
+            c1.fill(0); c2.fill(0); cu.fill(0); ceq.fill(0); cg1.fill(0); cg2.fill(0);
+            hll::detail::joint_unroller().sum_arrays(h1.core(), h2.core(), c1, c2, cu, cg1, cg2, ceq);
+        });
+        const double kernel_time = time_reps(nreps, [&]() {
+            hll::detail::joint_histogram_t jh;
+            cu.fill(0); ceq.fill(0); cg1.fill(0); cg2.fill(0);
+            jh.add(h1.data(), h2.data(), h1.size());
+            jh.finalize(cu, cg1, cg2, ceq);
+        });
+        volatile double sink = 0.;
+        const double joint_time = time_reps(nreps, [&]() {sink = sink + hll::ertl_joint(h1, h2)[2];});
+        const double union_time = time_reps(nreps, [&]() {sink = sink + h1.union_size(h2);});
+        std::fprintf(stdout, "%u\t%lf\t%lf\t%lf\t%lf\t%lf\n", p, bytes / unroller_time * 1e-9, bytes / kernel_time * 1e-9,
+                     bytes / joint_time * 1e-9, bytes / union_time * 1e-9, unroller_time / kernel_time);
+    }
+}
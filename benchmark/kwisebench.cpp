@@ -0,0 +1,62 @@
+#include "common.h"
+#include "hash.h"
+#include "aesctr/wy.h"
+#include <chrono>
+
+using namespace sketch;
+using namespace hash;
+using clk = std::chrono::high_resolution_clock;
+
+template<typename F>
+double seconds(const F &func) {
+    auto start = clk::now();
+    func();
+    return std::chrono::duration<double>(clk::now() - start).count();
+}
+
+/*
+ * Compares scalar evaluation of 4-wise independent hashes against SIMD Horner evaluation,
+ * both for arrays of keys under one hasher (hash_batch) and for one key under every hasher of a KWiseHasherSet (hash_all),
+ * as count sketches do for each update.
+ * Usage: kwisebench [nkeys=1<<22]
+ */
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): size_t(1) << 22;
+    wy::WyHash<uint64_t> gen(1337);
+    std::vector<uint64_t> keys(n), out(n);
+    for(auto &k: keys) k = gen();
+    uint64_t sum = 0;
+
+    KWiseIndependentPolynomialHash<4> hf;
+    const double scalar_time = seconds([&]() {for(size_t i = 0; i < n; ++i) out[i] = hf(keys[i]);});
+    sum += std::accumulate(out.begin(), out.end(), uint64_t(0));
+    const double batch_time = seconds([&]() {hf.hash_batch(keys.data(), out.data(), n);});
+    sum -= std::accumulate(out.begin(), out.end(), uint64_t(0));
+    std::fprintf(stdout, "#op\tnhashers\tscalar_s\tsimd_s\tscalar_mhps\tsimd_mhps\tspeedup\n");
+    std::fprintf(stdout, "hash_batch\t1\t%lf\t%lf\t%lf\t%lf\t%lf\n", scalar_time, batch_time, n / scalar_time * 1e-6, n / batch_time * 1e-6, scalar_time / batch_time);
+
+    for(const size_t nh: {1, 3, 4, 5, 8, 16}) {
+        KWiseHasherSet<4> set(nh);
+        std::vector<uint64_t> hashes(nh);
+        const size_t nkeys = n / nh;
+        uint64_t scalar_sum = 0, simd_sum = 0;
+        const double set_scalar_time = seconds([&]() {
+            for(size_t i = 0; i < nkeys; ++i) {
+                for(unsigned j = 0; j < nh; ++j) hashes[j] = set(keys[i], j);
+                scalar_sum += std::accumulate(hashes.begin(), hashes.end(), uint64_t(0));
+            }
+        });
+        const double set_simd_time = seconds([&]() {
+            for(size_t i = 0; i < nkeys; ++i) {
+                set.hash_all(keys[i], hashes.data());
+                simd_sum += std::accumulate(hashes.begin(), hashes.end(), uint64_t(0));
+            }
+        });
+        sum += scalar_sum - simd_sum;
+        const double nhashes = double(nkeys) * nh;
+        std::fprintf(stdout, "hash_all\t%zu\t%lf\t%lf\t%lf\t%lf\t%lf\n", nh, set_scalar_time, set_simd_time,
+                     nhashes / set_scalar_time * 1e-6, nhashes / set_simd_time * 1e-6, set_scalar_time / set_simd_time);
+    }
+    if(sum) std::fprintf(stderr, "SIMD and scalar hashes differ\n");
+    return sum != 0;
+}
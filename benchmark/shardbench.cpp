@@ -0,0 +1,48 @@
+#include "hll.h"
+#include "aesctr/wy.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+template<typename F>
+double time_threads(unsigned nthreads, const F &func) {
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads);
+    auto start = clk::now();
+    for(unsigned tid = 0; tid < nthreads; ++tid) threads.emplace_back(func, tid);
+    for(auto &t: threads) t.join();
+    return std::chrono::duration<double>(clk::now() - start).count();
+}
+
+/*
+ * Compares concurrent insertion into a single hll_t (per-register CAS) against shardhll_t
+ * (private per-thread registers merged on read) at 1-64 threads.
+ * Usage: shardbench [p=14] [nelem=1<<24]
+ */
+int main(int argc, char *argv[]) {
+    const unsigned p = argc > 1 ? std::atoi(argv[1]): 14;
+    const size_t nelem = argc > 2 ? std::strtoull(argv[2], nullptr, 10): size_t(1) << 24;
+    std::vector<uint64_t> hashes(nelem);
+    wy::WyHash<uint64_t> gen(1337);
+    for(auto &h: hashes) h = gen();
+    std::fprintf(stdout, "#nthreads\tp\tcas_s\tcas_Mops\tshard_s\tshard_merge_s\tshard_Mops\tspeedup\n");
+    for(unsigned nthreads = 1; nthreads <= 64; nthreads <<= 1) {
+        const size_t per_thread = (nelem + nthreads - 1) / nthreads;
+        hll::hll_t h(p);
+        const double cas_time = time_threads(nthreads, [&](unsigned tid) {
+            for(size_t i = tid * per_thread, e = std::min(nelem, i + per_thread); i < e; h.add(hashes[i++]));
+        });
+        hll::shardhll_t sh(nthreads, p);
+        const double shard_time = time_threads(nthreads, [&](unsigned tid) {
+            for(size_t i = tid * per_thread, e = std::min(nelem, i + per_thread); i < e; ++i) sh.add(hashes[i], tid);
+        });
+        auto start = clk::now();
+        const double est = sh.report();
+        const double merge_time = std::chrono::duration<double>(clk::now() - start).count();
+        if(est != h.report()) std::fprintf(stderr, "Estimates differ: %lf vs %lf\n", est, h.report());
+        const double total = shard_time + merge_time;
+        std::fprintf(stdout, "%u\t%u\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\n", nthreads, p,
+                     cas_time, nelem / cas_time * 1e-6, shard_time, merge_time, nelem / total * 1e-6, cas_time / total);
+    }
+}
@@ -0,0 +1,52 @@
+#include "hll.h"
+#include "bf.h"
+#include "strhash.h"
+#include "aesctr/wy.h"
+#include <chrono>
+
+using namespace sketch;
+using clk = std::chrono::high_resolution_clock;
+
+template<typename F>
+double seconds(const F &func) {
+    auto start = clk::now();
+    func();
+    return std::chrono::duration<double>(clk::now() - start).count();
+}
+
+/*
+ * Compares hashing strings in a separate pass with std::hash and then inserting the hashes
+ * against hash::add_strings, which hashes blocks of strings with XXH3 and inserts each block,
+ * for strings of several mean lengths.
+ * Usage: strbench [nstrings=1<<21]
+ */
+int main(int argc, char *argv[]) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10): size_t(1) << 21;
+    wy::WyHash<uint64_t> gen(1337);
+    std::fprintf(stdout, "#structure\tmean_length\ttwo_pass_s\tadd_strings_s\ttwo_pass_mbps\tadd_strings_mbps\tspeedup\n");
+    for(const size_t meanlen: {8, 32, 128}) {
+        std::vector<std::string> strs(n);
+        size_t nbytes = 0;
+        for(auto &s: strs) {
+            s.resize(1 + gen() % (2 * meanlen));
+            for(auto &c: s) c = 'a' + gen() % 26;
+            nbytes += s.size();
+        }
+        std::vector<uint64_t> hashes(n);
+        hll::hll_t h1(16), h2(16);
+        const double hll_two = seconds([&]() {
+            std::transform(strs.begin(), strs.end(), hashes.begin(), std::hash<std::string>());
+            h1.add_batch(hashes);
+        });
+        const double hll_one = seconds([&]() {hash::add_strings(h2, strs);});
+        bf::bf_t b1(24, 4, 137), b2(24, 4, 137);
+        const double bf_two = seconds([&]() {
+            std::transform(strs.begin(), strs.end(), hashes.begin(), std::hash<std::string>());
+            for(const auto h: hashes) b1.addh(h);
+        });
+        const double bf_one = seconds([&]() {hash::add_strings(b2, strs);});
+        if(std::abs(h1.report() - h2.report()) > 0.05 * h1.report()) std::fprintf(stderr, "Estimates differ: %lf, %lf\n", h1.report(), h2.report());
+        std::fprintf(stdout, "hll_t\t%zu\t%lf\t%lf\t%lf\t%lf\t%lf\n", meanlen, hll_two, hll_one, nbytes / hll_two * 1e-6, nbytes / hll_one * 1e-6, hll_two / hll_one);
+        std::fprintf(stdout, "bf_t\t%zu\t%lf\t%lf\t%lf\t%lf\t%lf\n", meanlen, bf_two, bf_one, nbytes / bf_two * 1e-6, nbytes / bf_one * 1e-6, bf_two / bf_one);
+    }
+}
@@ -0,0 +1,49 @@
+#include "hll.h"
+#include "aesctr/wy.h"
+#include <x86intrin.h>
+
+using namespace sketch;
+
+template<typename F>
+double cycles_per_rep(size_t nreps, const F &func) {
+    const uint64_t start = __rdtsc();
+    for(size_t i = 0; i < nreps; ++i) func();
+    return double(__rdtsc() - start) / nreps;
+}
+
+/*
+ * Measures register histogram throughput in bytes/cycle, comparing the single-histogram SIMDHolder::inc_counts loop
+ * against detail::byte_histogram_t for a single sketch (sum) and for the union of two (union_size), at p=10..24.
+ * Usage: sumbench [nreps=16]
+ */
+int main(int argc, char *argv[]) {
+    const size_t nreps = argc > 1 ? std::strtoull(argv[1], nullptr, 10): 16;
+    wy::WyHash<uint64_t> gen(1337);
+    std::fprintf(stdout, "#p\tsingle_Bpc\tmulti_Bpc\tsum_speedup\tunion_single_Bpc\tunion_multi_Bpc\tunion_speedup\n");
+    for(unsigned p = 10; p <= 24; p += 2) {
+        hll::hll_t h1(p), h2(p);
+        for(size_t i = 0, n = size_t(4) << p; i < n; ++i) h1.add(gen()), h2.add(gen());
+        using hll::detail::SIMDHolder;
+        const SIMDHolder *const p1 = reinterpret_cast<const SIMDHolder *>(h1.data()), *const p2 = reinterpret_cast<const SIMDHolder *>(h2.data());
+        const size_t nvecs = h1.size() / sizeof(SIMDHolder);
+        std::array<uint32_t, 64> single, multi, usingle, umulti;
+        const double single_cycles = cycles_per_rep(nreps, [&]() {
+            single.fill(0);
+            for(size_t i = 0; i < nvecs; p1[i++].inc_counts(single));
+        });
+        const double multi_cycles = cycles_per_rep(nreps, [&]() {multi = hll::detail::sum_counts(h1.core());});
+        const double usingle_cycles = cycles_per_rep(nreps, [&]() {
+            usingle.fill(0);
+            for(size_t i = 0; i < nvecs; ++i) SIMDHolder(SIMDHolder::max_fn(p1[i].val, p2[i].val)).inc_counts(usingle);
+        });
+        const double umulti_cycles = cycles_per_rep(nreps, [&]() {
+            hll::detail::byte_histogram_t<64> hist;
+            hist.add_max(h1.data(), h2.data(), h1.size());
+            umulti = hist.counts();
+        });
+        if(single != multi || usingle != umulti) std::fprintf(stderr, "Histograms differ at p = %u\n", p);
+        const double bytes = h1.size();
+        std::fprintf(stdout, "%u\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\n", p, bytes / single_cycles, bytes / multi_cycles, single_cycles / multi_cycles,
+                     2. * bytes / usingle_cycles, 2. * bytes / umulti_cycles, usingle_cycles / umulti_cycles);
+    }
+}
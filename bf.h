@@ -2,6 +2,8 @@
 #define CRUEL_BLOOM_H__
 #include "common.h"
 #include "hash.h"
+#include "strhash.h"
+#include "stats.h"
 
 
 #ifdef INCLUDE_CLHASH_H_
@@ -46,7 +48,12 @@ static constexpr size_t optimal_nhashes(size_t l2sz, size_t est_cardinality) {
     return ipart + ((fpart - ipart) != 0);
 }
 
-template<typename HashStruct=WangHash>
+// Salts of the split-block Bloom filter in Apache Parquet and Impala, one per 32-bit word of a block.
+static constexpr uint32_t BLOCK_SALTS[] {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+template<typename HashStruct=WangHash, bool Blocked=false>
 class bfbase_t {
 // Blocked bloom filter implementation.
 // To make it general, the actual point of entry is a 64-bit integer hash function.
@@ -67,6 +74,12 @@ protected:
     uint64_t                                    mask_;
 public:
     static constexpr unsigned OFFSET = 6; // log2(CHAR_BIT * 8) == log2(64) == 6
+    // If Blocked, the filter is split into 256-bit blocks, and a key sets one bit in each 32-bit word of a single block,
+    // chosen by one 64-bit hash: its high half selects the block and its low half, multiplied by each word's salt, the bit.
+    // Insertions and queries then touch one cache line rather than nhashes, and are a single vector OR or test.
+    // The number of hashes is fixed at BLOCK_HASHES, and the filter has at least one block.
+    static constexpr unsigned BLOCK_P = 8, BLOCK_WORDS = (1u << BLOCK_P) / 64, BLOCK_HASHES = 8;
+    static constexpr bool is_blocked() {return Blocked;}
     using HashType = HashStruct;
 
     using final_type = bfbase_t;
@@ -91,6 +104,10 @@ public:
     {
         //if(l2sz < OFFSET) throw std::runtime_error("Need at least a power of size 6\n");
         if(np_ > 40u) throw std::runtime_error(std::string("Attempting to make a table that's too large. p:") + std::to_string(np_));
+        CONST_IF(Blocked) {
+            nh_ = BLOCK_HASHES;
+            np_ = std::max(np_, uint8_t(BLOCK_P - OFFSET));
+        }
         if(np_) resize(1ull << p());
 #if !NDEBUG
         else std::fprintf(stderr, "np is small. (%u). offset %i. \n", unsigned(np_), int(l2sz) - OFFSET);
@@ -179,6 +196,38 @@ public:
         for(unsigned subhind = 1; subhind < n; set1((hv >> (subhind++ * shift))));
     }
 
+    // Blocked mode
+    INLINE uint64_t block_hash(uint64_t element) const {return hf_(element ^ seeds_[0]);}
+    INLINE uint64_t *block(uint64_t hv) {return core_.data() + ((hv >> 32) & (core_.size() / BLOCK_WORDS - 1)) * BLOCK_WORDS;}
+    INLINE const uint64_t *block(uint64_t hv) const {return core_.data() + ((hv >> 32) & (core_.size() / BLOCK_WORDS - 1)) * BLOCK_WORDS;}
+#if __AVX2__
+    static INLINE __m256i block_mask(uint32_t hv) {
+        const __m256i salts = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(BLOCK_SALTS));
+        return _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(hv), salts), 27));
+    }
+#endif
+    INLINE void block_set(uint64_t hv) {
+        uint64_t *const b = block(hv);
+#if __AVX2__
+        __m256i *const bp = reinterpret_cast<__m256i *>(b);
+        _mm256_store_si256(bp, _mm256_or_si256(_mm256_load_si256(bp), block_mask(hv)));
+#else
+        uint32_t *const words = reinterpret_cast<uint32_t *>(b);
+        for(unsigned i = 0; i < BLOCK_HASHES; ++i) words[i] |= uint32_t(1) << ((uint32_t(hv) * BLOCK_SALTS[i]) >> 27);
+#endif
+    }
+    INLINE bool block_contains(uint64_t hv) const {
+        const uint64_t *const b = block(hv);
+#if __AVX2__
+        return _mm256_testc_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(b)), block_mask(hv));
+#else
+        const uint32_t *const words = reinterpret_cast<const uint32_t *>(b);
+        uint32_t missing = 0;
+        for(unsigned i = 0; i < BLOCK_HASHES; ++i) missing |= ~words[i] & (uint32_t(1) << ((uint32_t(hv) * BLOCK_SALTS[i]) >> 27));
+        return missing == 0;
+#endif
+    }
+
     uint64_t popcnt_manual() const {
         return std::accumulate(core_.cbegin() + 1, core_.cend(), popcount(core_[0]), [](auto a, auto b) {return a + popcount(b);});
     }
@@ -242,7 +291,7 @@ public:
         if(other.m() != m()) throw std::runtime_error("Can't compare different-sized bloom filters.");
         auto &oc = other.core_;
         const Type *op(reinterpret_cast<const Type *>(oc.data())), *tc(reinterpret_cast<const Type *>(core_.data()));
-        Space::VType l1 = *op++, l2 = *tc++;
+        Space::VType l1, l2;
         Space::VType tmp;
         Space::Type sum1(Space::set1(0)), sum2 = sum1, sumu = sum1;
 
@@ -251,7 +300,7 @@ public:
         sum1 = Space::add(sum1, popcnt_fn(l1.simd_));\
         sum2 = Space::add(sum2, popcnt_fn(l2.simd_));\
         tmp = Space::or_fn(l1.simd_, l2.simd_); \
-        sum2 = Space::add(sumu, popcnt_fn(tmp));
+        sumu = Space::add(sumu, popcnt_fn(tmp));
 
         if(core_.size() / Space::COUNT >= 8) {
             REPEAT_7(PERFORM_ITER)
@@ -272,7 +321,7 @@ public:
         if(other.m() != m()) throw std::runtime_error("Can't compare different-sized bloom filters.");
         auto &oc = other.core_;
         const Type *op(reinterpret_cast<const Type *>(oc.data())), *tc(reinterpret_cast<const Type *>(core_.data()));
-        Space::VType l1 = *op++, l2 = *tc++;
+        Space::VType l1, l2;
         Space::VType tmp;
         Space::Type sum1(Space::set1(0)), sum2 = sum1, sumu = sum1;
 
@@ -304,6 +353,11 @@ public:
 
     INLINE void add(const uint64_t element) {addh(element);}
     INLINE void addh(const uint64_t element) {
+        if(stats::enabled()) stats::add(stats::INSERTS);
+        CONST_IF(Blocked) {
+            block_set(block_hash(element));
+            return;
+        }
         // TODO: descend farther in batching, doing each subhash together for cache efficiency.
         unsigned nleft = nh_, npw = lut::nhashesper64bitword[p()], npersimd = Space::COUNT * npw;
         const auto shift = p();
@@ -328,7 +382,7 @@ public:
             addh(hf_(element));
         else
 #endif
-            addh(std::hash<std::string>{}(element)); // IE, do if not replaced.
+            addh(hash::XXH3Hasher()(element)); // IE, do if not replaced.
     }
     // Reset.
     void clear() {
@@ -421,6 +475,7 @@ public:
         } else
             for(i = 0; i < (core_.size() / Space::COUNT); ++i)
                 els[i].simd_ = Space::or_fn(els[i].simd_, oels[i].simd_);
+        if(stats::enabled()) stats::add(stats::MERGES);
         return *this;
     }
 #define DEFOP(opchar)\
@@ -436,6 +491,7 @@ public:
     // Clears, allows reuse with different np.
     void resize(size_t new_size) {
         new_size = roundup(new_size);
+        CONST_IF(Blocked) new_size = std::max(new_size, size_t(1) << BLOCK_P);
         clear();
         core_.resize(new_size >> OFFSET);
         clear();
@@ -446,6 +502,7 @@ public:
     }
     // Getter for is_calculated_
     bool may_contain(uint64_t val) const {
+        CONST_IF(Blocked) return block_contains(block_hash(val));
         bool ret = true;
         unsigned nleft = nh_;
         assert(p() < sizeof(lut::nhashesper64bitword));
@@ -470,6 +527,12 @@ public:
         return ret;
     }
     bool may_contain_and_addh(uint64_t val) {
+        CONST_IF(Blocked) {
+            const uint64_t hv = block_hash(val);
+            const bool ret = block_contains(hv);
+            block_set(hv);
+            return ret;
+        }
         bool ret = true;
         unsigned nleft = nh_;
         assert(p() < sizeof(lut::nhashesper64bitword));
@@ -491,44 +554,96 @@ public:
         }
         return ret;
     }
-    void may_contain(const std::vector<uint64_t> vals, std::vector<uint64_t> &ret) const {
-        return may_contain(vals.data(), vals.size(), ret);
+    // Batch queries and insertions are software-pipelined: the bit positions of a window of keys are computed and
+    // their cache lines prefetched, and then the previous window's keys are resolved, so that the cache misses of
+    // BATCH_WINDOW keys' probes overlap instead of each probe waiting on the one before it.
+    // Filters of at most PIPELINE_MIN_BYTES are likely cache-resident, where prefetching only costs instructions,
+    // and their keys are inserted or queried one at a time instead.
+    static constexpr size_t BATCH_WINDOW = 32, PIPELINE_MIN_BYTES = size_t(1) << 20;
+    bool pipelines_batches() const {return core_.size() * sizeof(uint64_t) > PIPELINE_MIN_BYTES;}
+    // Number of positions key_positions computes for a key
+    unsigned npositions() const {return Blocked ? 1: nh_;}
+    // The bit positions addh sets for a key, in the same order. In blocked mode, this is the key's single block hash.
+    INLINE void key_positions(uint64_t val, uint64_t *pos) const {
+        CONST_IF(Blocked) {
+            *pos = block_hash(val);
+            return;
+        }
+        const unsigned npw = lut::nhashesper64bitword[p()], shift = p();
+        const uint64_t *sptr = seeds_.data();
+        for(unsigned nleft = nh_, todo; nleft; nleft -= todo) {
+            const uint64_t hv = hf_(val ^ *sptr++);
+            todo = std::min(npw, nleft);
+            for(unsigned i = 0; i < todo; ++i) *pos++ = (hv >> (i * shift)) & mask_;
+        }
     }
-    auto &may_contain(const uint64_t *vals, size_t nvals, std::vector<uint64_t> &ret) const {
-        // TODO: descend farther in batching, doing each subhash together for cache efficiency.
-        ret.clear();
-#if !NDEBUG
-        std::fprintf(stderr, "nvals: %zu. nvals. Resize size: %zu\n", nvals, nvals >> 6 + ((nvals & 0x63u) != 0));
-#endif
-        ret.resize((nvals >> 6) + ((nvals & 0x63u) != 0), UINT64_C(-1));
-        unsigned nleft = nh_, npw = lut::nhashesper64bitword[p()], npersimd = Space::COUNT * npw;
-        const auto shift = p();
-        const VType *seedptr = reinterpret_cast<const VType *>(&seeds_[0]);
-        VType seed, v;
-        while(nleft > npersimd) {
-            seed.simd_ = (*seedptr++).simd_;
-            for(unsigned  i(0); i < nvals; ++i) {
-                v = hf_(Space::set1(vals[i]) ^ seed.simd_);
-                v.for_each([&](const uint64_t &val) {
-                    ret[i >> 6] &= UINT64_C(-1) ^ (static_cast<uint64_t>(!all_set(val, npw, shift)) << (i & 63u));
-                });
+    template<bool write>
+    INLINE void prefetch_positions(const uint64_t *pos) const {
+        CONST_IF(Blocked) __builtin_prefetch(block(*pos), write);
+        else for(unsigned i = 0; i < nh_; ++i) __builtin_prefetch(&core_[pos[i] >> OFFSET], write);
+    }
+    // Calls func(i, positions of vals[i]) for each key, computing and prefetching the positions of the next window first.
+    template<bool write, typename Func>
+    void for_each_pipelined(const uint64_t *vals, size_t n, const Func &func) const {
+        const unsigned npos = npositions();
+        std::vector<uint64_t> buf(2 * BATCH_WINDOW * npos);
+        auto fill = [&](size_t start, uint64_t *pos) {
+            for(size_t i = start, end = std::min(n, start + BATCH_WINDOW); i < end; ++i, pos += npos) {
+                key_positions(vals[i], pos);
+                prefetch_positions<write>(pos);
             }
-            nleft -= npersimd;
+        };
+        if(n) fill(0, buf.data());
+        for(size_t start = 0, w = 0; start < n; start += BATCH_WINDOW, w ^= 1) {
+            const uint64_t *pos = buf.data() + w * BATCH_WINDOW * npos;
+            if(start + BATCH_WINDOW < n) fill(start + BATCH_WINDOW, buf.data() + (w ^ 1) * BATCH_WINDOW * npos);
+            for(size_t i = start, end = std::min(n, start + BATCH_WINDOW); i < end; ++i, pos += npos) func(i, pos);
         }
-        const uint64_t *sptr = reinterpret_cast<const uint64_t *>(seedptr);
-        while(nleft) {
-            uint64_t hv, seed = *sptr++;
-            for(unsigned i(0); i < nvals; ++i) {
-                hv = hf_(vals[i] ^ seed);
-                ret[i >> 6] &= UINT64_C(-1) ^ (static_cast<uint64_t>(!all_set(hv, std::min(npw, nleft), shift)) << (i & 63u));
-            }
-            nleft -= std::min(npw, nleft);
+    }
+    // Sets bit i of bitmap, which has (n + 63) / 64 words, if vals[i] may be in the filter, and clears it otherwise.
+    void may_contain(const uint64_t *vals, size_t n, uint64_t *bitmap) const {
+        std::fill(bitmap, bitmap + (n + 63) / 64, uint64_t(0));
+        if(!pipelines_batches()) {
+            for(size_t i = 0; i < n; ++i) bitmap[i >> 6] |= uint64_t(may_contain(vals[i])) << (i & 63);
+            return;
         }
+        for_each_pipelined<false>(vals, n, [&](size_t i, const uint64_t *pos) {
+            bool ret;
+            CONST_IF(Blocked) ret = block_contains(*pos);
+            else {
+                ret = true;
+                for(unsigned j = 0; j < nh_; ++j) ret &= (core_[pos[j] >> OFFSET] >> (pos[j] & 63)) & 1;
+            }
+            bitmap[i >> 6] |= uint64_t(ret) << (i & 63);
+        });
+    }
+    auto &may_contain(const uint64_t *vals, size_t nvals, std::vector<uint64_t> &ret) const {
+        ret.resize((nvals + 63) / 64);
+        may_contain(vals, nvals, ret.data());
         return ret;
     }
+    void may_contain(const std::vector<uint64_t> &vals, std::vector<uint64_t> &ret) const {
+        may_contain(vals.data(), vals.size(), ret);
+    }
+    // Inserts n keys, as addh does, pipelined as may_contain is.
+    void addh_batch(const uint64_t *vals, size_t n) {
+        if(!pipelines_batches()) {
+            for(size_t i = 0; i < n; addh(vals[i++]));
+            return;
+        }
+        for_each_pipelined<true>(vals, n, [this](size_t, const uint64_t *pos) {
+            CONST_IF(Blocked) block_set(*pos);
+            else for(unsigned j = 0; j < nh_; ++j) core_[pos[j] >> OFFSET] |= uint64_t(1) << (pos[j] & 63);
+        });
+        if(stats::enabled()) stats::add(stats::INSERTS, n);
+    }
+    template<typename Container>
+    void addh_batch(const Container &con) {addh_batch(con.data(), con.size());}
 
     const auto &core()    const {return core_;}
     const uint64_t *data() const {return core_.data();}
+    uint64_t *data() {return core_.data();} // Allows filling a filter from serialized data.
+    uint64_t seedseed() const {return seedseed_;}
 
     void free() {
         decltype(core_) tmp{};
@@ -551,8 +666,9 @@ public:
     }
     DBSKETCH_WRITE_STRING_MACROS
     DBSKETCH_READ_STRING_MACROS
+    // Blocked filters are marked by writing 0 for the number of hashes, which no standard filter has.
     ssize_t write(gzFile fp) const {
-        uint8_t arr[] {np_, nh_, uint8_t(seeds_.size())};
+        uint8_t arr[] {np_, Blocked ? uint8_t(0): nh_, uint8_t(seeds_.size())};
         ssize_t ret = gzwrite(fp, arr, sizeof(arr));
         ret += gzwrite(fp, &hf_, sizeof(hf_));
         ret += gzwrite(fp, &seedseed_, sizeof(seedseed_));
@@ -564,19 +680,28 @@ public:
     ssize_t read(gzFile fp) {
         uint8_t arr[3] {0};
         ssize_t ret = gzread(fp, arr, sizeof(arr));
+        if((arr[1] == 0) != Blocked)
+            throw std::runtime_error(Blocked ? "Reading a standard Bloom filter as a blocked one.": "Reading a blocked Bloom filter as a standard one.");
         np_ = arr[0];
-        nh_ = arr[1];
-        seeds_.resize(arr[2]);
+        nh_ = Blocked ? BLOCK_HASHES: arr[1];
         ret += gzread(fp, &hf_, sizeof(hf_));
         ret += gzread(fp, &seedseed_, sizeof(seedseed_));
         ret += gzread(fp, &mask_, sizeof(mask_));
+        seeds_.clear();
         if(np_) resize(1ull << p());
+        // The seeds written are read back rather than regenerated, and must be consumed before the bits.
+        seeds_.resize(arr[2]);
+        ret += gzread(fp, seeds_.data(), seeds_.size() * sizeof(seeds_[0]));
         ret += gzread(fp, core_.data(), core_.size() * sizeof(core_[0]));
         return ret;
     }
 };
 
 using bf_t = bfbase_t<>;
+// Split-block Bloom filter
+template<typename HashStruct=WangHash>
+using sbfbase_t = bfbase_t<HashStruct, true>;
+using sbf_t = sbfbase_t<>;
 
 // Returns the size of the set intersection
 template<typename BloomType>
@@ -4,6 +4,7 @@
 #include <queue>
 #include "common.h"
 #include "hash.h"
+#include "stats.h"
 
 namespace sketch {
 
@@ -448,6 +449,7 @@ public:
         return ret;
     }
     ssize_t add(const uint64_t val) {
+        if(stats::enabled()) stats::add(stats::INSERTS);
         unsigned nhdone = 0, seedind = 0;
         const auto nperhash64 = lut::nhashesper64bitword[l2sz_];
         const auto nbitsperhash = l2sz_;
@@ -580,6 +582,7 @@ public:
         for(size_t i(0), e(data_.size()); i < e; ++i) {
             data_[i] = updater_.combine(data_[i], other.data_[i]);
         }
+        if(stats::enabled()) stats::add(stats::MERGES);
         return *this;
     }
 };
@@ -615,6 +618,7 @@ public:
         return sqrl2(core_, nh_, np_);
     }
     CounterType addh_val(uint64_t val) {
+        if(stats::enabled()) stats::add(stats::INSERTS);
         alloca_wrap<CounterType> counts(nh_);
         auto cptr = counts.get();
         uint64_t v = hf_(val);
@@ -633,6 +637,7 @@ public:
         return (cptr[(nh_ >> 1)] + cptr[(nh_ - 1 ) >> 1]) >> 1;
     }
     void addh(uint64_t val) {
+        if(stats::enabled()) stats::add(stats::INSERTS);
         uint64_t v = hf_(val);
         unsigned added;
         for(added = 0; added < std::min(nph_, nh_); v >>= (np_ + 1), add(v, added++));
@@ -738,6 +743,7 @@ const noexcept
         }
     }
     INLINE void addh(Space::VType hv) noexcept {
+        if(stats::enabled()) stats::add(stats::INSERTS, Space::COUNT);
         unsigned gadded = 0;
         Space::VType(hf_(hv)).for_each([&](uint64_t v) {
             for(uint32_t added = 0; added++ < std::min(nph_, nh_) && gadded < nh_;v >>= (np_ + 1))
@@ -789,6 +795,7 @@ const
     csbase_t &operator+=(const csbase_t &o) {
         for(size_t i = 0; i < core_.size(); ++i)
             core_[i] += o.core_[i];
+        if(stats::enabled()) stats::add(stats::MERGES);
         return *this;
     }
     csbase_t operator+(const csbase_t &o) const {
@@ -809,6 +816,10 @@ class cs4wbase_t {
      * Either the item collided with another item which was quite large and it was outweighed
      * or it and others in the bucket were not heavy enough and by chance it did
      * not weigh over the other items with the opposite sign. Treat these as 0s.
+     *
+     * Compatibility: hashers used to be built as KWiseHasherSet(seedseed), i.e. seedseed hashers seeded by 137.
+     * They are now built as nh hashers seeded by seedseed, so only sketches constructed with the default seedseed of 137
+     * match those built by earlier versions; any other seedseed yields different hashers and incompatible counters.
     */
     std::vector<CounterType, Allocator<CounterType>> core_;
     uint32_t np_, nh_;
@@ -822,7 +833,7 @@ public:
     cs4wbase_t(unsigned np, unsigned nh=1, unsigned seedseed=137, Args &&...args):
         core_(uint64_t(nh) << np), np_(np), nh_(nh),
         mask_((1ull << np_) - 1),
-        hf_(seedseed)
+        hf_(nh, seedseed)
     {
     }
     double l2est() const {
@@ -831,6 +842,7 @@ public:
     cs4wbase_t &operator+=(const cs4wbase_t &o) {
         for(size_t i = 0; i < core_.size(); ++i)
             core_[i] += o.core_[i];
+        if(stats::enabled()) stats::add(stats::MERGES);
         return *this;
     }
     cs4wbase_t operator+(const cs4wbase_t &o) const {
@@ -839,30 +851,40 @@ public:
         return tmp;
     }
     CounterType addh_val(uint64_t val) {
+        if(stats::enabled()) stats::add(stats::INSERTS);
+        alloca_wrap<uint64_t> hashes(nh_);
         alloca_wrap<CounterType> counts(nh_);
+        hf_.hash_all(val, hashes.get());
         auto cptr = counts.get();
         for(unsigned added = 0; added < nh_; ++added) {
-            *cptr++ = add(val, added);
+            *cptr++ = add_hashed(hashes.get()[added], added);
         }
         sort::insertion_sort(counts.get(), cptr);
         cptr = counts.get();
         return (cptr[(nh_ >> 1)] + cptr[(nh_ - 1 ) >> 1]) >> 1;
     }
     void addh(uint64_t val) {
+        if(stats::enabled()) stats::add(stats::INSERTS);
+        alloca_wrap<uint64_t> hashes(nh_);
+        hf_.hash_all(val, hashes.get());
         for(unsigned added = 0; added < nh_; ++added) {
-            add(val, added);
+            add_hashed(hashes.get()[added], added);
         }
     }
     void subh(uint64_t val) {
+        alloca_wrap<uint64_t> hashes(nh_);
+        hf_.hash_all(val, hashes.get());
         for(unsigned added = 0; added < nh_; ++added) {
-            sub(val, added);
+            sub_hashed(hashes.get()[added], added);
         }
     }
     auto subh_val(uint64_t val) {
+        alloca_wrap<uint64_t> hashes(nh_);
         alloca_wrap<CounterType> counts(nh_);
+        hf_.hash_all(val, hashes.get());
         auto cptr = counts.get();
         for(unsigned added = 0; added < nh_; ++added) {
-            *cptr++ = sub(val, added);
+            *cptr++ = sub_hashed(hashes.get()[added], added);
         }
         sort::insertion_sort(counts.get(), cptr);
         cptr = counts.get();
@@ -872,11 +894,16 @@ public:
         return (hv & mask_) + (subidx << np_);
     }
     INLINE auto add(uint64_t hv, unsigned subidx) noexcept {
-        hv = hf_(hv, subidx);
-        return at_pos(hv, subidx) += sign(hv);
+        return add_hashed(hf_(hv, subidx), subidx);
     }
     INLINE auto sub(uint64_t hv, unsigned subidx) noexcept {
-        hv = hf_(hv, subidx);
+        return sub_hashed(hf_(hv, subidx), subidx);
+    }
+    // Update row subidx given the hash of a key under its hasher, as computed for all rows at once by hf_.hash_all.
+    INLINE auto add_hashed(uint64_t hv, unsigned subidx) noexcept {
+        return at_pos(hv, subidx) += sign(hv);
+    }
+    INLINE auto sub_hashed(uint64_t hv, unsigned subidx) noexcept {
         return at_pos(hv, subidx) -= sign(hv);
     }
     INLINE auto &at_pos(uint64_t hv, unsigned subidx) noexcept {
@@ -900,10 +927,10 @@ const noexcept
         return hv & (1ul << np_) ? 1: -1;
     }
     INLINE void subh(Space::VType hv) noexcept {
-        hv.for_each([&](auto x) {for(size_t i = 0; i < nh_; sub(x, i++));});
+        hv.for_each([&](auto x) {subh(x);});
     }
     INLINE void addh(Space::VType hv) noexcept {
-        hv.for_each([&](auto x) {for(size_t i = 0; i < nh_; add(x, i++));});
+        hv.for_each([&](auto x) {addh(x);});
     }
     CounterType est_count(uint64_t val) 
 #if !NDEBUG
@@ -912,9 +939,11 @@ const
 #endif
 {
         common::detail::alloca_wrap<CounterType> mem(nh_);
+        common::detail::alloca_wrap<uint64_t> hashes(nh_);
+        hf_.hash_all(val, hashes.get());
         CounterType *ptr = mem.get(), *p = ptr;
         for(unsigned i = 0; i < nh_; ++i) {
-            auto v = hf_(val, i);
+            auto v = hashes.get()[i];
             *p++ = at_pos(v, i) * sign(v);
         }
         if(nh_ > 1) {
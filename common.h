@@ -8,9 +8,11 @@
 #include <climits>
 #include <cmath>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <mutex>
 #include <random>
 #include <set>
 #include <stdexcept>
@@ -505,5 +507,48 @@ enum MHCardinalityMode: uint8_t {
     HLL_METHOD, // Should perform worse than harmonic
 };
 
+namespace io {
+// Checked reads and writes for sketches' serialization methods, which throw std::runtime_error on failure.
+static inline void gzwrite_all(gzFile fp, const void *src, size_t len) {
+    if(len && size_t(gzwrite(fp, src, len)) != len) throw std::runtime_error("Error writing to file.");
+}
+static inline void gzread_all(gzFile fp, void *dst, size_t len) {
+    if(size_t(gzread(fp, dst, len)) != len) throw std::runtime_error("Error reading from file.");
+}
+static inline void write_all(int fd, const void *src, size_t len) {
+    if(::write(fd, src, len) != ssize_t(len)) throw std::runtime_error("Failed to write to disk.");
+}
+static inline void read_all(int fd, void *dst, size_t len) {
+    if(::read(fd, dst, len) != ssize_t(len)) throw std::runtime_error("Failed to read from file descriptor.");
+}
+// Writes obj to path with obj.write(gzFile).
+template<typename T>
+void write_path(const T &obj, const char *path) {
+    gzFile fp(gzopen(path, "wb"));
+    if(fp == nullptr) throw std::runtime_error(std::string("Could not open file at ") + path);
+    try {obj.write(fp);} catch(...) {gzclose(fp); throw;}
+    gzclose(fp);
+}
+// Writes obj to path with obj.write(gzFile), or uncompressed with obj.write(int) if write_gz is false.
+template<typename T>
+void write_path(const T &obj, const char *path, bool write_gz) {
+    if(write_gz) write_path(obj, path);
+    else {
+        std::FILE *fp(std::fopen(path, "wb"));
+        if(fp == nullptr) throw std::runtime_error(std::string("Could not open file at ") + path);
+        try {obj.write(fileno(fp));} catch(...) {std::fclose(fp); throw;}
+        std::fclose(fp);
+    }
+}
+// Reads obj from path with obj.read(gzFile), which also reads uncompressed files.
+template<typename T>
+void read_path(T &obj, const char *path) {
+    gzFile fp(gzopen(path, "rb"));
+    if(fp == nullptr) throw std::runtime_error(std::string("Could not open file at ") + path);
+    try {obj.read(fp);} catch(...) {gzclose(fp); throw;}
+    gzclose(fp);
+}
+} // namespace io
+
 } // namespace common
 } // namespace sketch
@@ -1,10 +1,12 @@
 #ifndef DBSKETCH_HASH_H__
 #define DBSKETCH_HASH_H__
+#include <algorithm>
 #include <cstdint>
 #include <array>
 #include <type_traits>
 #include <vector>
 #include <climits>
+#include <cstring>
 #include <memory>
 #include "vec/vec.h"
 
@@ -17,6 +19,58 @@ using std::size_t;
 using Type  = typename vec::SIMDTypes<uint64_t>::Type;
 using VType = typename vec::SIMDTypes<uint64_t>::VType;
 using Space = vec::SIMDTypes<uint64_t>;
+
+namespace detail {
+// Lane-wise low 64 bits of x * y, from three 32x32->64-bit products where AVX512DQ's mullo is unavailable.
+static INLINE Type mullo64(Type x, Type y) {
+#if VECTOR_WIDTH == 64
+#  if __AVX512DQ__
+    return _mm512_mullo_epi64(x, y);
+#  else
+    const __m512i cross = _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(x, 32), y), _mm512_mul_epu32(x, _mm512_srli_epi64(y, 32)));
+    return _mm512_add_epi64(_mm512_mul_epu32(x, y), _mm512_slli_epi64(cross, 32));
+#  endif
+#elif VECTOR_WIDTH == 32
+    const __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), y), _mm256_mul_epu32(x, _mm256_srli_epi64(y, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(x, y), _mm256_slli_epi64(cross, 32));
+#else
+    const __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), y), _mm_mul_epu32(x, _mm_srli_epi64(y, 32)));
+    return _mm_add_epi64(_mm_mul_epu32(x, y), _mm_slli_epi64(cross, 32));
+#endif
+}
+// Lane-wise full 64-bit products of the low 32 bits of x and y.
+static INLINE Type mul_epu32(Type x, Type y) {
+#if VECTOR_WIDTH == 64
+    return _mm512_mul_epu32(x, y);
+#elif VECTOR_WIDTH == 32
+    return _mm256_mul_epu32(x, y);
+#else
+    return _mm_mul_epu32(x, y);
+#endif
+}
+
+static INLINE Type as_simd(Type x) {return x;}
+static INLINE Type as_simd(const VType &x) {return x.simd_;}
+// Hashes in[0..n) into out[0..n), Space::COUNT keys at a time through hf's vector overload taking VecT (Type or VType),
+// then the tail one key at a time. Each vector of keys is loaded before its hashes are stored, so out may equal in.
+// Keys are loaded and stored as Type rather than through VType, whose byte-wise copies would defeat store forwarding.
+template<typename VecT, typename Hasher>
+INLINE void hash_batch_vec(const Hasher &hf, const uint64_t *in, uint64_t *out, size_t n) {
+    size_t i = 0;
+    for(Type key; i + Space::COUNT <= n; i += Space::COUNT) {
+        std::memcpy(&key, in + i, sizeof(key));
+        key = as_simd(hf(VecT(key)));
+        std::memcpy(out + i, &key, sizeof(key));
+    }
+    for(; i < n; ++i) out[i] = hf(in[i]);
+}
+// For hashers of only a few shifts and xors, which the compiler vectorizes on its own.
+template<typename Hasher>
+INLINE void hash_batch_scalar(const Hasher &hf, const uint64_t *in, uint64_t *out, size_t n) {
+    for(size_t i = 0; i < n; ++i) out[i] = hf(in[i]);
+}
+} // namespace detail
+
 // Thomas Wang hash
 // Original site down, available at https://naml.us/blog/tag/thomas-wang
 // This is our core 64-bit hash.
@@ -95,6 +149,8 @@ struct WangHash {
         key = ~(key-(tmp<<21));
         return key;
     }
+    // Hashes n keys into out, which may be the same as in.
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n) const {detail::hash_batch_vec<Type>(*this, in, out, n);}
 };
 
 // pcg32
@@ -244,6 +300,39 @@ inline uint64_t i61hash(uint64_t x, const std::array<uint64_t, n> & keys) {
     }
 	return mod61(tsum);
 }
+// Lane-wise arithmetic modulo 2^61-1, for evaluating i61hash's polynomials over vectors of keys or of hashers.
+// Returns a value of at most 2^61-1 congruent to x, for any x.
+INLINE Type fold61(Type x) {
+    const Type mod = Space::set1((uint64_t(1) << 61) - 1);
+    x = Space::add(Space::and_fn(x, mod), Space::srli(x, 61)); // At most 2^61+6
+    return Space::add(Space::and_fn(x, mod), Space::srli(x, 61));
+}
+// Maps 2^61-1 to 0, so that the result of fold61 is in [0, 2^61-1), like mod61's.
+INLINE Type canon61(Type x) {
+    return Space::and_fn(Space::add(x, Space::srli(Space::add(x, Space::set1(uint64_t(1))), 61)), Space::set1((uint64_t(1) << 61) - 1));
+}
+// Returns a value less than 2^63 congruent to x * y, for x and y of at most 2^61-1, given yhi = y >> 32.
+// x * y = hi * 2^64 + mid * 2^32 + lo, where 2^64 = 8 and mid * 2^32 = (mid >> 29) + (mid % 2^29) * 2^32 modulo 2^61-1.
+INLINE Type mul61(Type x, Type y, Type yhi) {
+    const Type mod = Space::set1((uint64_t(1) << 61) - 1), xhi = Space::srli(x, 32);
+    const Type lo = detail::mul_epu32(x, y), hi = detail::mul_epu32(xhi, yhi);
+    const Type mid = Space::add(detail::mul_epu32(xhi, y), detail::mul_epu32(x, yhi));
+    const Type ret = Space::add(Space::slli(hi, 3), Space::add(Space::srli(mid, 29), Space::and_fn(Space::slli(mid, 32), mod)));
+    return Space::add(ret, Space::add(Space::and_fn(lo, mod), Space::srli(lo, 61)));
+}
+// Evaluates c(k-1) * x^(k-1) + ... + c(1) * x + c(0) modulo 2^61-1 by Horner's rule, lane-wise,
+// where c(i) returns the vector of degree-i coefficients, each less than 2^61-1.
+// This is the polynomial i61hash sums term by term, and the result is the same.
+template<size_t k, typename Coeffs>
+INLINE Type horner61(Type x, const Coeffs &c) {
+    x = fold61(x);
+    const Type xhi = Space::srli(x, 32);
+    Type ret = c(k - 1);
+    for(size_t i = k - 1; i--;)
+        ret = fold61(Space::add(mul61(ret, x, xhi), c(i)));
+    return canon61(ret);
+}
+
 template<size_t k>
 inline uint64_t i128hash(uint64_t x, const std::array<uint64_t, k> & keys) {
     // Use 2**127
@@ -279,28 +368,19 @@ public:
 		return nosiam::i61hash<k>(val, coeffs_);
 #endif
     }
-    Type operator()(VType val) const {
-        throw std::runtime_error("Should not be called... yet. TODO: this");
-        // Data parallel across same coefficients.
-        VType ret = Space::set1(coeffs_[0][0]);
-        VType exp = val;
-        for(size_t i = 1; i < k; ++i) {
-#if HAS_AVX_512
-            auto tmp = Space::mullo(exp.simd_, Space::set1(coeffs_[i]));
-            tmp.for_each([](auto &x) {x %= mod;});
-            ret = Space::add(ret, tmp.simd_);
-            ret.for_each([](auto &x) {x %= mod;});
-            exp = Space::mullo(exp.simd_, val.simd_);
-            exp.for_each([](auto &x) {x %= mod;});
+    // Hashes Space::COUNT keys at once.
+    Type operator()(Type val) const {
+#ifndef NO_USE_SIAM
+        VType ret = val;
+        for(uint32_t j = 0; j < Space::COUNT; ++j) ret.arr_[j] = this->operator()(ret.arr_[j]);
+        return ret.simd_;
 #else
-            for(uint32_t j = 0; j < Space::COUNT; ++j) {
-                ret.arr_[j] = (ret.arr_[j] + (exp.arr_[j] * coeffs_[i] % mod)) % mod;
-                exp.arr_[j] = (exp.arr_[j] * val.arr_[j]) % mod;
-            }
+        return nosiam::horner61<k>(val, [this](size_t i) {return Space::set1(coeffs_[i]);});
 #endif
-        }
-        return ret.simd_;
     }
+    Type operator()(VType val) const {return this->operator()(val.simd_);}
+    const auto &coefficients() const {return coeffs_;}
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n) const {detail::hash_batch_vec<Type>(*this, in, out, n);}
 #ifdef DUMMY_INVERSE
     uint64_t inverse(uint64_t val) { return val;} // This is a lie for compatibility only
 #endif
@@ -308,14 +388,51 @@ public:
 template<size_t k>
 struct KWiseHasherSet {
     std::vector<KWiseIndependentPolynomialHash<k>> hashers_;
+#ifdef NO_USE_SIAM
+    // Coefficients of degree i of hashers [h, h + Space::COUNT) are at [i * stride_ + h], zero-padded to whole vectors,
+    // so that hash_all evaluates one key under Space::COUNT hashers at a time.
+    std::vector<uint64_t> coeffs_;
+    size_t stride_;
+#endif
     KWiseHasherSet(size_t nh, uint64_t seedseed=137) {
         std::mt19937_64 mt(seedseed);
         while(hashers_.size() < nh)
             hashers_.emplace_back(mt());
+#ifdef NO_USE_SIAM
+        stride_ = (nh + Space::COUNT - 1) / Space::COUNT * Space::COUNT;
+        coeffs_.resize(k * stride_);
+        for(size_t h = 0; h < nh; ++h)
+            for(size_t i = 0; i < k; ++i)
+                coeffs_[i * stride_ + h] = hashers_[h].coefficients()[i];
+#endif
+    }
+    size_t size() const {return hashers_.size();}
+    // Hashes v with every hasher, writing size() hashes to out, as one vector per Space::COUNT hashers.
+    void hash_all(uint64_t v, uint64_t *out) const {
+#ifdef NO_USE_SIAM
+        const size_t nh = hashers_.size();
+        const Type key = Space::set1(v);
+        for(size_t h = 0; h < nh; h += Space::COUNT) {
+            Type ret = nosiam::horner61<k>(key, [this,h](size_t i) {
+                Type c;
+                std::memcpy(&c, &coeffs_[i * stride_ + h], sizeof(c));
+                return c;
+            });
+            if(h + Space::COUNT <= nh) std::memcpy(out + h, &ret, sizeof(ret));
+            else {
+                const VType tail = ret;
+                std::copy(tail.arr_, tail.arr_ + (nh - h), out + h);
+            }
+        }
+#else
+        for(size_t h = 0; h < hashers_.size(); ++h) out[h] = hashers_[h](v);
+#endif
     }
     uint64_t operator()(uint64_t v, unsigned ind) const {
         return hashers_[ind](v);
     }
+    // Hashes n keys with the ind-th hasher.
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n, unsigned ind) const {hashers_[ind].hash_batch(in, out, n);}
     uint64_t operator()(uint64_t v) const {throw std::runtime_error("Should not be called.");}
 };
 
@@ -352,9 +469,9 @@ struct MurFinHash {
     INLINE Type operator()(VType key) const {
 #if 1
         key = Space::srli(key.simd_, 33) ^ key.simd_;  // h ^= h >> 33;
-        key.for_each([](auto &x) {x *= C1;});
+        key = detail::mullo64(key.simd_, Space::set1(C1));
         key = Space::srli(key.simd_, 33) ^ key.simd_;  // h ^= h >> 33;
-        key.for_each([](auto &x) {x *= C2;});
+        key = detail::mullo64(key.simd_, Space::set1(C2));
         key = Space::srli(key.simd_, 33) ^ key.simd_;  // h ^= h >> 33;
 #else
         __m128i *p = (__m128i *)&key;
@@ -363,6 +480,7 @@ struct MurFinHash {
 #endif
         return key.simd_;
     }
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n) const {detail::hash_batch_vec<Type>(*this, in, out, n);}
 };
 
 static INLINE uint64_t finalize(uint64_t key) {
@@ -375,15 +493,7 @@ template<typename T>
 struct multiplies {
     T operator()(T x, T y) const { return x * y;}
     VType operator()(VType x, VType y) const {
-#if HAS_AVX_512
-        return Space::mullo(x.simd_, y.simd_);
-#else
-        uint64_t *p1 = reinterpret_cast<uint64_t *>(&x), *p2 = reinterpret_cast<uint64_t *>(&y);
-        for(uint32_t i = 0; i < sizeof(VType) / sizeof(uint64_t); ++i) {
-            p1[i] *= p2[i];
-        }
-        return x;
-#endif
+        return detail::mullo64(x.simd_, y.simd_);
     }
 };
 template<typename T>
@@ -463,6 +573,7 @@ struct InvRShiftXor {
     }
     uint64_t inverse(uint64_t x) const {return InverseOperation()(x);}
     using InverseOperation = RShiftXor<n>;
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n_) const {detail::hash_batch_scalar(*this, in, out, n_);}
 };
 
 template<size_t n>
@@ -472,6 +583,7 @@ struct RShiftXor {
     uint64_t constexpr operator()(uint64_t v) const {return v ^ (v >> n);}
     uint64_t inverse(uint64_t x) const {return InverseOperation()(x);}
     using InverseOperation = InvRShiftXor<n>;
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n_) const {detail::hash_batch_scalar(*this, in, out, n_);}
 };
 template<size_t n> using ShiftXor = RShiftXor<n>;
 template<size_t n> using ShiftXor = RShiftXor<n>;
@@ -485,6 +597,7 @@ struct XORConstantHasher {
         return h ^ XORVALUE;
     }
     uint64_t inverse(uint64_t h) const {return h ^ XORVALUE;}
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n_) const {detail::hash_batch_scalar(*this, in, out, n_);}
 };
 
 template<size_t n>
@@ -498,6 +611,7 @@ struct LShiftXor {
     uint64_t constexpr operator()(uint64_t v) const {return v ^ (v << n);}
     uint64_t constexpr inverse(uint64_t v) const {return InverseOperation()(v);}
     using InverseOperation = InvLShiftXor<n>;
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n_) const {detail::hash_batch_scalar(*this, in, out, n_);}
 };
 template<size_t n>
 struct InvLShiftXor {
@@ -512,6 +626,7 @@ struct InvLShiftXor {
     }
     constexpr uint64_t inverse(uint64_t v) const {return InverseOperation()(v);}
     using InverseOperation = LShiftXor<n>;
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n_) const {detail::hash_batch_scalar(*this, in, out, n_);}
 };
 
 
@@ -525,6 +640,9 @@ struct Rot {
         return left ? (val << n) ^ (val >> (64 - n))
                     : (val >> n) ^ (val << (64 - n));
     }
+    INLINE VType operator()(VType val) const {
+        return Space::or_fn(Space::slli(val.simd_, left ? n: 64 - n), Space::srli(val.simd_, left ? 64 - n: n));
+    }
     template<typename T>
     INLINE T constexpr inverse(T val) const {
         return InverseOperation()(val);
@@ -533,6 +651,7 @@ struct Rot {
     INLINE T constexpr operator()(T val, const T2 &oval) const { // DO nothing
         return this->operator()(val);
     }
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n_) const {detail::hash_batch_vec<VType>(*this, in, out, n_);}
     using InverseOperation = Rot<n, !left>;
 };
 template<size_t n> using RotL = Rot<n, true>;
@@ -552,6 +671,7 @@ struct BitFlip {
     INLINE T constexpr operator()(T val, const T2 &oval) const { // DO nothing
         return this->operator()(val);
     }
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n) const {detail::hash_batch_scalar(*this, in, out, n);}
     using InverseOperation = BitFlip;
 };
 
@@ -587,6 +707,7 @@ struct InvH {
         h = op(h, s);
         return h;
     }
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n) const {detail::hash_batch_vec<VType>(*this, in, out, n);}
 };
 
 // Reversible, runtime-configurable hashes
@@ -609,6 +730,7 @@ struct FusedReversible {
         hv = op1.inverse(op2.inverse(hv));
         return hv;
     }
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n) const {detail::hash_batch_vec<VType>(*this, in, out, n);}
 };
 template<typename InvH1, typename InvH2, typename InvH3>
 struct FusedReversible3 {
@@ -626,6 +748,7 @@ struct FusedReversible3 {
         hv = op1.inverse(op2.inverse(op3.inverse(hv)));
         return hv;
     }
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n) const {detail::hash_batch_vec<VType>(*this, in, out, n);}
 };
 
 using InvXor = InvH<op::bit_xor<uint64_t>>;
@@ -667,6 +790,7 @@ struct RecursiveReversibleHash {
         std::for_each(v_.rbegin(), v_.rend(), [&](const auto &hash) {hv = hash.inverse(hv);});
         return hv;
     }
+    void hash_batch(const uint64_t *in, uint64_t *out, size_t n) const {detail::hash_batch_vec<VType>(*this, in, out, n);}
 };
 
 struct XorMultiplyNVec: public RecursiveReversibleHash<XorMultiply> {
@@ -704,6 +828,26 @@ struct XorMultiplyN: XorMultiplyNVec{
     XorMultiplyN(): XorMultiplyNVec(n) {}
 };
 
+namespace detail {
+template<typename Hasher>
+auto hash_batch_dispatch(const Hasher &hf, const uint64_t *in, uint64_t *out, size_t n, int)
+    -> decltype(hf.hash_batch(in, out, n), void())
+{
+    hf.hash_batch(in, out, n);
+}
+template<typename Hasher>
+void hash_batch_dispatch(const Hasher &hf, const uint64_t *in, uint64_t *out, size_t n, long) {
+    hash_batch_scalar(hf, in, out, n);
+}
+} // namespace detail
+
+// Hashes n keys into out (which may be in) with hf's hash_batch if it has one, or one key at a time otherwise,
+// so that code generic over its hash function can share the kernels above.
+template<typename Hasher>
+INLINE void hash_batch(const Hasher &hf, const uint64_t *in, uint64_t *out, size_t n) {
+    detail::hash_batch_dispatch(hf, in, out, n, 0);
+}
+
 } // namespace hash
 } // namespace sketch
 
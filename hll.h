@@ -2,6 +2,8 @@
 #define HLL_H_
 #include "common.h"
 #include "hash.h"
+#include "strhash.h"
+#include "stats.h"
 
 namespace sketch { namespace hll { namespace detail {
 
@@ -488,14 +490,162 @@ struct joint_unroller {
     }
 };
 
+// Union, first-greater, second-greater and equal register histograms for Ertl's joint estimator.
+struct joint_counts_t {
+    std::array<uint32_t, 64> cu, cg1, cg2, ceq;
+};
+
+// Accumulates the histograms needed by Ertl's joint estimator over pairs of register arrays.
+// Each pair of registers is reduced with SIMD comparisons to a single key, max(r1, r2) | (r1 > r2) << 6 | (r2 > r1) << 7,
+// which is counted into one of four interleaved histograms so that runs of equal keys don't serialize on one counter.
+// This replaces six scalar increments per register pair with one.
+struct joint_histogram_t {
+    static constexpr size_t NBINS = 192;
+    static constexpr uint8_t G1 = 0x40, G2 = 0x80;
+    uint32_t counts_[4][NBINS];
+    joint_histogram_t() {clear();}
+    void clear() {std::memset(counts_, 0, sizeof(counts_));}
+    INLINE void count(const uint8_t *keys, size_t n) {
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            ++counts_[0][keys[i]]; ++counts_[1][keys[i + 1]];
+            ++counts_[2][keys[i + 2]]; ++counts_[3][keys[i + 3]];
+        }
+        for(; i < n; ++counts_[0][keys[i++]]);
+    }
+    void add(const uint8_t *a, const uint8_t *b, size_t n) {
+        alignas(64) uint8_t keys[64];
+        size_t i = 0;
+#if __AVX512BW__
+        {
+            const __m512i vg1 = _mm512_set1_epi8(G1), vg2 = _mm512_set1_epi8(static_cast<char>(G2));
+            for(; i + 64 <= n; i += 64) {
+                const __m512i va = _mm512_loadu_si512(a + i), vb = _mm512_loadu_si512(b + i);
+                __m512i key = _mm512_max_epu8(va, vb);
+                key = _mm512_or_si512(key, _mm512_maskz_mov_epi8(_mm512_cmpgt_epu8_mask(va, vb), vg1));
+                key = _mm512_or_si512(key, _mm512_maskz_mov_epi8(_mm512_cmpgt_epu8_mask(vb, va), vg2));
+                _mm512_store_si512(keys, key);
+                count(keys, 64);
+            }
+        }
+#endif
+#if __AVX2__
+        {
+            const __m256i vg1 = _mm256_set1_epi8(G1), vg2 = _mm256_set1_epi8(static_cast<char>(G2));
+            for(; i + 32 <= n; i += 32) {
+                const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                              vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+                // Registers are < 64, so signed comparisons are safe.
+                const __m256i key = _mm256_or_si256(_mm256_max_epu8(va, vb),
+                                                    _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi8(va, vb), vg1),
+                                                                    _mm256_and_si256(_mm256_cmpgt_epi8(vb, va), vg2)));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(keys), key);
+                count(keys, 32);
+            }
+        }
+#endif
+#if __SSE2__
+        {
+            const __m128i vg1 = _mm_set1_epi8(G1), vg2 = _mm_set1_epi8(static_cast<char>(G2));
+            for(; i + 16 <= n; i += 16) {
+                const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)),
+                              vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+                const __m128i key = _mm_or_si128(_mm_max_epu8(va, vb),
+                                                 _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(va, vb), vg1),
+                                                              _mm_and_si128(_mm_cmpgt_epi8(vb, va), vg2)));
+                _mm_store_si128(reinterpret_cast<__m128i *>(keys), key);
+                count(keys, 16);
+            }
+        }
+#endif
+        for(; i < n; ++i)
+            ++counts_[0][std::max(a[i], b[i]) | (a[i] > b[i] ? G1: 0) | (b[i] > a[i] ? G2: 0)];
+    }
+    // Adds the union, first-greater, second-greater and equal histograms to the arrays provided.
+    template<typename T>
+    void finalize(T &cu, T &cg1, T &cg2, T &ceq) const {
+        for(size_t i = 0; i < 64; ++i) {
+            const uint32_t eq = counts_[0][i] + counts_[1][i] + counts_[2][i] + counts_[3][i],
+                           g1 = counts_[0][i | G1] + counts_[1][i | G1] + counts_[2][i | G1] + counts_[3][i | G1],
+                           g2 = counts_[0][i | G2] + counts_[1][i | G2] + counts_[2][i | G2] + counts_[3][i | G2];
+            ceq[i] += eq; cg1[i] += g1; cg2[i] += g2;
+            cu[i] += eq + g1 + g2;
+        }
+    }
+};
+
+// Histogram of byte values over NBINS bins, with NBINS a power of two.
+// Registers in a sketch cluster around a few values, so successive increments of one histogram mostly hit the same counter
+// and serialize on store-to-load forwarding. Bytes are instead loaded eight at a time and counted into NSUB interleaved
+// sub-histograms, which are only summed when the counts are read.
+// Values are masked to the number of bins, which is always a no-op for registers of a valid sketch.
+template<size_t NBINS>
+struct byte_histogram_t {
+    static constexpr size_t NSUB = 8;
+    static constexpr uint64_t MASK = NBINS - 1;
+    static_assert(NBINS <= 256 && (NBINS & (NBINS - 1)) == 0, "NBINS must be a power of two no greater than 256.");
+    uint32_t counts_[NSUB][NBINS];
+    byte_histogram_t() {clear();}
+    void clear() {std::memset(counts_, 0, sizeof(counts_));}
+    void add(const uint8_t *p, size_t n) {
+        size_t i = 0;
+        for(uint64_t w; i + 8 <= n; i += 8) {
+            std::memcpy(&w, p + i, sizeof(w));
+            ++counts_[0][w & MASK];         ++counts_[1][(w >> 8) & MASK];
+            ++counts_[2][(w >> 16) & MASK]; ++counts_[3][(w >> 24) & MASK];
+            ++counts_[4][(w >> 32) & MASK]; ++counts_[5][(w >> 40) & MASK];
+            ++counts_[6][(w >> 48) & MASK]; ++counts_[7][(w >> 56) & MASK];
+        }
+        for(; i < n; ++i) ++counts_[i & (NSUB - 1)][p[i] & MASK];
+    }
+    // Counts the elementwise maxima of a and b, i.e., the registers of the union of two sketches.
+    void add_max(const uint8_t *a, const uint8_t *b, size_t n) {
+        alignas(64) uint8_t u[64];
+        size_t i = 0;
+#if __AVX512BW__
+        for(; i + 64 <= n; i += 64) {
+            _mm512_store_si512(u, _mm512_max_epu8(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i)));
+            add(u, 64);
+        }
+#elif __AVX2__
+        for(; i + 64 <= n; i += 64) {
+            _mm256_store_si256(reinterpret_cast<__m256i *>(u), _mm256_max_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                                                                                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i))));
+            _mm256_store_si256(reinterpret_cast<__m256i *>(u + 32), _mm256_max_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i + 32)),
+                                                                                     _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i + 32))));
+            add(u, 64);
+        }
+#elif __SSE2__
+        for(; i + 16 <= n; i += 16) {
+            _mm_store_si128(reinterpret_cast<__m128i *>(u), _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)),
+                                                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))));
+            add(u, 16);
+        }
+#endif
+        for(; i < n; ++i) ++counts_[i & (NSUB - 1)][std::max(a[i], b[i]) & MASK];
+    }
+    // Adds the counts to those in counts.
+    template<typename T>
+    void finalize(T &counts) const {
+        for(size_t i = 0; i < NBINS; ++i) {
+            uint32_t sum = 0;
+            for(size_t j = 0; j < NSUB; sum += counts_[j++][i]);
+            counts[i] += sum;
+        }
+    }
+    std::array<uint32_t, NBINS> counts() const {
+        std::array<uint32_t, NBINS> ret{0};
+        finalize(ret);
+        return ret;
+    }
+};
+
 template<typename T>
 inline void inc_counts(T &counts, const SIMDHolder *p, const SIMDHolder *pend) {
     static_assert(std::is_integral<std::decay_t<decltype(counts[0])>>::value, "Counts must be integral.");
-    SIMDHolder tmp;
-    do {
-        tmp = *p++;
-        tmp.inc_counts(counts);
-    } while(p < pend);
+    byte_histogram_t<64> hist;
+    hist.add(reinterpret_cast<const uint8_t *>(p), reinterpret_cast<const uint8_t *>(pend) - reinterpret_cast<const uint8_t *>(p));
+    hist.finalize(counts);
 }
 
 static inline std::array<uint32_t, 64> sum_counts(const SIMDHolder *p, const SIMDHolder *pend) {
@@ -526,13 +676,9 @@ template<typename CoreType>
 void parsum_helper(void *data_, long index, int tid) {
     parsum_data_t<CoreType> &data(*reinterpret_cast<parsum_data_t<CoreType> *>(data_));
     uint64_t local_counts[64]{0};
-    SIMDHolder tmp;
     const SIMDHolder *p(reinterpret_cast<const SIMDHolder *>(&data.core_[index * data.pb_])),
                      *pend(reinterpret_cast<const SIMDHolder *>(&data.core_[std::min(data.l_, (index+1) * data.pb_)]));
-    do {
-        tmp = *p++;
-        tmp.inc_counts(local_counts);
-    } while(p < pend);
+    inc_counts(local_counts, p, pend);
     for(uint64_t i = 0; i < 64ull; ++i) data.counts_[i] += local_counts[i];
 }
 
@@ -577,7 +723,9 @@ TODO:  Consider adding this change to the method. This could improve our perform
     gprev = 0;
     double deltaX = x;
     relerr /= std::sqrt(m);
+    unsigned niter = 0;
     while(deltaX > x*relerr) {
+        ++niter;
         int kappaMinus1;
         frexp(x, &kappaMinus1);
         double xPrime = ldexp(x, -std::max(static_cast<int>(kMaxPrime+1), kappaMinus1+2));
@@ -601,6 +749,7 @@ TODO:  Consider adding this change to the method. This could improve our perform
         x += deltaX;
         gprev = g;
     }
+    if(stats::enabled()) stats::add(stats::ESTIMATOR_ITERATIONS, niter);
     return x*m;
 }
 
@@ -609,36 +758,119 @@ double ertl_ml_estimate(const HllType& c, double relerr=1e-2) {
     return ertl_ml_estimate(detail::sum_counts(c.core()), c.p(), c.q(), relerr);
 }
 
-} // namespace detail
+// Number of hashes converted to (index, rank) pairs before registers are touched by batch insertion.
+// Small enough to keep the index/rank buffers in L1, large enough to overlap the register cache misses.
+static constexpr size_t BATCH_SIZE = 64;
+
+// Converts n hash values into register indices and leading-zero ranks for a sketch with 2**p registers.
+// Equivalent to performing `hashval >> q` and `clz(((hashval << 1)|1) << (p - 1)) + 1` for each hash.
+static INLINE void hashes2regs(const uint64_t *hashes, uint32_t *indices, uint8_t *ranks, size_t n, unsigned p) {
+    const unsigned q = 64 - p;
+    const uint64_t pbit = UINT64_C(1) << (p - 1);
+    size_t i = 0;
+#if __AVX512CD__ && __AVX512F__
+    const __m512i vpbit = _mm512_set1_epi64(pbit), vone = _mm512_set1_epi64(1);
+    for(; i + 8 <= n; i += 8) {
+        const __m512i h = _mm512_loadu_si512(hashes + i);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(indices + i), _mm512_cvtepi64_epi32(_mm512_srli_epi64(h, q)));
+        const __m512i r = _mm512_add_epi64(_mm512_lzcnt_epi64(_mm512_or_si512(_mm512_slli_epi64(h, p), vpbit)), vone);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(ranks + i), _mm512_cvtepi64_epi8(r));
+    }
+#endif
+    for(; i < n; ++i) {
+        indices[i] = hashes[i] >> q;
+        ranks[i] = clz((hashes[i] << p) | pbit) + 1;
+    }
+}
 
-template<typename HllType>
-std::array<double, 3> ertl_joint(const HllType &h1, const HllType &h2) {
-    assert(h1.m() == h2.m() || !std::fprintf(stderr, "sizes don't match! Size1: %zu. Size2: %zu\n", h1.size(), h2.size()));
-    std::array<double, 3> ret;
-    if(h1.get_jestim() != ERTL_JOINT_MLE) {
-        ret[2] = h1.union_size(h2);
-        ret[0] = h1.creport();
-        ret[1] = h2.creport();
-        ret[2] = ret[0] + ret[1] - ret[2];
-        ret[0] -= ret[2];
-        ret[1] -= ret[2];
-        ret[2] = std::max(ret[2], 0.);
-        return ret;
+// Raises *ptr to at least val with compare-and-swap, adding failed attempts to retries.
+// Returns whether this call raised the register.
+static INLINE bool cas_max(uint8_t *ptr, uint8_t val, unsigned &retries) {
+    for(uint8_t cur; (cur = *ptr) < val; ++retries)
+        if(__sync_bool_compare_and_swap(ptr, cur, val)) return true;
+    return false;
+}
+
+// Bitmask of the nonzero bytes among the 64 starting at p.
+static INLINE uint64_t nonzero_mask64(const uint8_t *p) {
+#if __AVX512BW__
+    const __m512i v = _mm512_loadu_si512(p);
+    return _mm512_test_epi8_mask(v, v);
+#elif __AVX2__
+    const __m256i z = _mm256_setzero_si256();
+    const uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)), z)),
+                   hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32)), z));
+    return ~((uint64_t(hi) << 32) | lo);
+#elif __SSE2__
+    const __m128i z = _mm_setzero_si128();
+    uint64_t ret = 0;
+    for(unsigned i = 0; i < 4; ++i)
+        ret |= uint64_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i)), z))) << (16 * i);
+    return ~ret;
+#else
+    uint64_t ret = 0;
+    for(unsigned i = 0; i < 64; ++i) ret |= uint64_t(p[i] != 0) << i;
+    return ret;
+#endif
+}
+
+// Reduces registers of a sketch with 2**p registers to 2**new_p registers (Algorithm 3 in https://arxiv.org/abs/1702.01284).
+// Each new register folds a group of 2**(p - new_p) consecutive registers: the group offset j of its first nonzero register supplies
+// the leading bits of the new rank, so the new value is d - ilog2(j) for j > 0 or the old value plus d for j == 0, where d = p - new_p.
+// Groups are located with a nonzero mask per 64 bytes rather than a byte-at-a-time scan.
+// dst may equal src, in which case the registers are reduced in place: each group is read before its slot is written.
+static inline void fold_registers(const uint8_t *src, uint8_t *dst, unsigned p, unsigned new_p) {
+    const unsigned d = p - new_p;
+    const size_t ratio = size_t(1) << d, new_m = size_t(1) << new_p, m = size_t(1) << p;
+    if(d == 0) {
+        if(dst != src) std::memmove(dst, src, m);
+        return;
+    }
+    if(m < 64) {
+        for(size_t i = 0; i < new_m; ++i) {
+            const uint8_t *const g = src + i * ratio;
+            size_t j = 0;
+            while(j < ratio && g[j] == 0) ++j;
+            dst[i] = j == ratio ? 0: j ? d - ilog2(j): g[0] + d;
+        }
+    } else if(ratio <= 64) {
+        const uint64_t gmask = ratio == 64 ? ~uint64_t(0): (uint64_t(1) << ratio) - 1;
+        for(size_t b = 0, i = 0; b < m; b += 64) {
+            const uint64_t mask = nonzero_mask64(src + b);
+            for(size_t g = 0; g < 64; g += ratio, ++i) {
+                const uint64_t gm = (mask >> g) & gmask;
+                dst[i] = gm == 0 ? 0: gm & 1 ? src[b + g] + d: d - ilog2(ctz(gm));
+            }
+        }
+    } else {
+        for(size_t i = 0; i < new_m; ++i) {
+            const uint8_t *const g = src + i * ratio;
+            uint8_t v = 0;
+            for(size_t j = 0; j < ratio; j += 64) {
+                if(const uint64_t mask = nonzero_mask64(g + j)) {
+                    const size_t first = j + ctz(mask);
+                    v = first ? d - ilog2(first): g[0] + d;
+                    break;
+                }
+            }
+            dst[i] = v;
+        }
     }
-    using detail::ertl_ml_estimate;
-    auto p = h1.p();
-    auto q = h1.q();
-    std::array<uint32_t, 64> c1{0}, c2{0}, cu{0}, ceq{0}, cg1{0}, cg2{0};
-    detail::joint_unroller ju;
-    ju.sum_arrays(h1.core(), h2.core(), c1, c2, cu, cg1, cg2, ceq);
-    const double cAX = h1.get_is_ready() ? h1.creport() : ertl_ml_estimate(c1, h1.p(), h1.q());
-    const double cBX = h2.get_is_ready() ? h2.creport() : ertl_ml_estimate(c2, h2.p(), h2.q());
-    const double cABX = ertl_ml_estimate(cu, h1.p(), h1.q());
+}
+
+// Completes Ertl's joint MLE given the histograms of the union (cu), of registers greater in the first (cg1)
+// or the second (cg2) sketch, of equal registers (ceq), and the cardinality estimates of each sketch.
+// Returns the estimated number of elements unique to h1, unique to h2, and in the intersection.
+template<typename CountArrType>
+std::array<double, 3> ertl_joint_estimate(const CountArrType &cu, const CountArrType &cg1, const CountArrType &cg2, const CountArrType &ceq,
+                                          double cAX, double cBX, unsigned p, unsigned q) {
+    std::array<double, 3> ret;
+    const double cABX = ertl_ml_estimate(cu, p, q);
     // std::fprintf(stderr, "Made initials: %lf, %lf, %lf\n", cAX, cBX, cABX);
     std::array<uint32_t, 64> countsAXBhalf;
     std::array<uint32_t, 64> countsBXAhalf;
-    countsAXBhalf[q] = h1.m();
-    countsBXAhalf[q] = h1.m();
+    countsAXBhalf[q] = uint64_t(1) << p;
+    countsBXAhalf[q] = uint64_t(1) << p;
     for(unsigned _q = 0; _q < q; ++_q) {
         // Handle AXBhalf
         countsAXBhalf[_q] = cg1[_q] + ceq[_q] + cg2[_q + 1];
@@ -661,6 +893,45 @@ std::array<double, 3> ertl_joint(const HllType &h1, const HllType &h2) {
     return ret;
 }
 
+} // namespace detail
+
+namespace detail {
+// The cardinality estimate ertl_joint uses for one sketch: the cached estimate if there is one, and its MLE otherwise.
+template<typename HllType>
+double ertl_card(const HllType &h) {
+    return h.get_is_ready() ? h.creport(): ertl_ml_estimate(sum_counts(h.core()), h.p(), h.q());
+}
+} // namespace detail
+
+// As ertl_joint below, but with the sketches' estimates (see detail::ertl_card) supplied by the caller,
+// which saves a pass over each sketch's registers when one sketch is compared with many.
+template<typename HllType>
+std::array<double, 3> ertl_joint(const HllType &h1, const HllType &h2, double cAX, double cBX) {
+    assert(h1.m() == h2.m());
+    std::array<uint32_t, 64> cu{0}, ceq{0}, cg1{0}, cg2{0};
+    detail::joint_histogram_t jh;
+    jh.add(h1.data(), h2.data(), h1.m());
+    jh.finalize(cu, cg1, cg2, ceq);
+    return detail::ertl_joint_estimate(cu, cg1, cg2, ceq, cAX, cBX, h1.p(), h1.q());
+}
+
+template<typename HllType>
+std::array<double, 3> ertl_joint(const HllType &h1, const HllType &h2) {
+    assert(h1.m() == h2.m() || !std::fprintf(stderr, "sizes don't match! Size1: %zu. Size2: %zu\n", h1.size(), h2.size()));
+    std::array<double, 3> ret;
+    if(h1.get_jestim() != ERTL_JOINT_MLE) {
+        ret[2] = h1.union_size(h2);
+        ret[0] = h1.creport();
+        ret[1] = h2.creport();
+        ret[2] = ret[0] + ret[1] - ret[2];
+        ret[0] -= ret[2];
+        ret[1] -= ret[2];
+        ret[2] = std::max(ret[2], 0.);
+        return ret;
+    }
+    return ertl_joint(h1, h2, detail::ertl_card(h1), detail::ertl_card(h2));
+}
+
 template<typename HllType>
 std::array<double, 3> ertl_joint(HllType &h1, HllType &h2) {
     if(h1.get_jestim() != ERTL_JOINT_MLE) h1.csum(), h2.csum();
@@ -679,8 +950,8 @@ constexpr double make_alpha(size_t m) {
 }
 
 
-// TODO: add a compact, 6-bit version
-// For now, I think that it's preferable for thread safety,
+// A compact, 6-bit version is available in packedhll.h.
+// hllbase_t keeps byte registers because that is preferable for thread safety,
 // considering there's an intrinsic for the atomic load/store, but there would not
 // be for bit-packed versions.
 
@@ -707,9 +978,6 @@ protected:
 public:
     using final_type = hllbase_t<HashStruct>;
     using HashType = HashStruct;
-#if LZ_COUNTER
-    std::array<std::atomic<uint64_t>, 64> clz_counts_; // To check for bias in insertion
-#endif
 
     std::pair<size_t, size_t> est_memory_usage() const {
         return std::make_pair(sizeof(*this),
@@ -738,14 +1006,11 @@ public:
         estim_(estim), jestim_(jestim)
         , hf_(std::forward<Args>(args)...)
     {
-#if LZ_COUNTER
-        std::memset(&clz_counts_[0], 0, sizeof(clz_counts_));
-#endif
         //std::fprintf(stderr, "p = %u. q = %u. size = %zu\n", np_, q(), core_.size());
     }
     explicit hllbase_t(size_t np, HashStruct &&hs): hllbase_t(np, ERTL_MLE, (JointEstimationMethod)ERTL_JOINT_MLE, std::move(hs)) {}
     explicit hllbase_t(size_t np, EstimationMethod estim=ERTL_MLE): hllbase_t(np, estim, (JointEstimationMethod)ERTL_JOINT_MLE) {}
-    explicit hllbase_t(): hllbase_t(0, EstimationMethod::ERTL_MLE, JointEstimationMethod::ERTL_JOINT_MLE) {}
+    explicit hllbase_t(): hllbase_t(size_t(0), EstimationMethod::ERTL_MLE, JointEstimationMethod::ERTL_JOINT_MLE) {}
     template<typename... Args>
     hllbase_t(const char *path, Args &&... args): hf_(std::forward<Args>(args)...) {read(path);}
     template<typename... Args>
@@ -801,18 +1066,16 @@ public:
     }
 
     INLINE void add(uint64_t hashval) {
-#ifndef NOT_THREADSAFE
-        for(const uint32_t index(hashval >> q()), lzt(clz(((hashval << 1)|1) << (np_ - 1)) + 1);
-            core_[index] < lzt;
-            __sync_bool_compare_and_swap(core_.data() + index, core_[index], lzt));
-#else
         const uint32_t index(hashval >> q());
         const uint8_t lzt(clz(((hashval << 1)|1) << (np_ - 1)) + 1);
+        unsigned retries = 0;
+#ifndef NOT_THREADSAFE
+        const bool updated = detail::cas_max(core_.data() + index, lzt, retries);
+#else
+        const bool updated = core_[index] < lzt;
         core_[index] = std::max(core_[index], lzt);
 #endif
-#if LZ_COUNTER
-        ++clz_counts_[clz(((hashval << 1)|1) << (np_ - 1)) + 1];
-#endif
+        if(stats::enabled()) stats::add_insert(lzt, updated, retries);
     }
 
     INLINE void addh(uint64_t element) {
@@ -825,7 +1088,7 @@ public:
             add(hf_(element));
         } else {
 #endif
-            add(std::hash<std::string>{}(element));
+            add(hash::XXH3Hasher()(element));
 #ifdef ENABLE_CLHASH
         }
 #endif
@@ -837,6 +1100,49 @@ public:
     INLINE void add(VType element) {
         element.for_each([&](uint64_t &val) {add(val);});
     }
+    // Bulk insertion of already-hashed values.
+    // Indices and ranks are computed for a block of hashes at a time, and their registers are prefetched
+    // before any are updated, so that cache misses overlap instead of serializing.
+    void add_batch(const uint64_t *hashes, size_t n) {
+        uint32_t indices[detail::BATCH_SIZE];
+        uint8_t  ranks[detail::BATCH_SIZE];
+        const bool record = stats::enabled();
+        for(size_t i = 0; i < n; i += detail::BATCH_SIZE) {
+            const size_t nb = std::min(n - i, detail::BATCH_SIZE);
+            detail::hashes2regs(hashes + i, indices, ranks, nb, np_);
+            for(size_t j = 0; j < nb; __builtin_prefetch(core_.data() + indices[j++], 1));
+            unsigned updates = 0, retries = 0;
+            for(size_t j = 0; j < nb; ++j) {
+#ifndef NOT_THREADSAFE
+                updates += detail::cas_max(core_.data() + indices[j], ranks[j], retries);
+#else
+                updates += core_[indices[j]] < ranks[j];
+                core_[indices[j]] = std::max(core_[indices[j]], ranks[j]);
+#endif
+            }
+            if(record) stats::add_inserts(ranks, nb, updates, retries);
+        }
+    }
+protected:
+    // Hashes values a block at a time with hash::hash_batch, calling func(hashes, n) on each block of hashes.
+    template<typename Func>
+    void hash_blocks(const uint64_t *vals, size_t n, const Func &func) const {
+        uint64_t buf[detail::BATCH_SIZE];
+        for(size_t i = 0; i < n; i += detail::BATCH_SIZE) {
+            const size_t nb = std::min(n - i, detail::BATCH_SIZE);
+            hash::hash_batch(hf_, vals + i, buf, nb);
+            func(static_cast<const uint64_t *>(buf), nb);
+        }
+    }
+public:
+    // Hashes values with the vectorized kernel of the hash function, where it has one, before bulk insertion.
+    void addh_batch(const uint64_t *vals, size_t n) {
+        hash_blocks(vals, n, [this](const uint64_t *hashes, size_t nb) {add_batch(hashes, nb);});
+    }
+    template<typename Container>
+    void add_batch(const Container &con) {add_batch(con.data(), con.size());}
+    template<typename Container>
+    void addh_batch(const Container &con) {addh_batch(con.data(), con.size());}
     template<typename T, typename Hasher=std::hash<T>>
     INLINE void adds(const T element, const Hasher &hasher) {
         static_assert(std::is_same<std::decay_t<decltype(hasher(element))>, uint64_t>::value, "Must return 64-bit hash");
@@ -878,24 +1184,22 @@ public:
     }
     hllbase_t<HashStruct> compress(size_t new_np) const {
         // See Algorithm 3 in https://arxiv.org/abs/1702.01284
-        // This is not very optimized.
         // I might later add support for doubling, c/o https://research.neustar.biz/2013/04/30/doubling-the-size-of-an-hll-dynamically-extra-bits/
         if(new_np == np_) return hllbase_t(*this);
         if(new_np > np_) throw std::runtime_error(std::string("Can't compress to a larger size. Current: ") + std::to_string(np_) + ". Requested new size: " + std::to_string(new_np));
         hllbase_t<HashStruct> ret(new_np, get_estim(), get_jestim());
-        size_t ratio = static_cast<size_t>(1) << (np_ - new_np);
-        size_t new_size = 1ull << new_np;
-        size_t b = 0;
-        for(size_t i(0); i < new_size; ++i) {
-            size_t j(0);
-            while(j < ratio && core_[j + b] == 0) ++j;
-            if(j != ratio)
-                ret.core_[i] = std::min(ret.q() + 1, j ? clz(j)+1: core_[b]);
-            // Otherwise left at 0
-            b += ratio;
-        }
+        detail::fold_registers(core_.data(), ret.core_.data(), np_, new_np);
         return ret;
     }
+    // As compress, but reduces the registers in place without allocating. Capacity is kept for reuse.
+    void compress_inplace(size_t new_np) {
+        if(new_np > np_) throw std::runtime_error(std::string("Can't compress to a larger size. Current: ") + std::to_string(np_) + ". Requested new size: " + std::to_string(new_np));
+        if(new_np == np_) return;
+        detail::fold_registers(core_.data(), core_.data(), np_, new_np);
+        np_ = new_np;
+        core_.resize(m());
+        not_ready();
+    }
     // Reset.
     void clear() {
         if(core_.size() > (1u << 16)) {
@@ -910,12 +1214,7 @@ public:
         std::swap_ranges(reinterpret_cast<uint8_t *>(this), reinterpret_cast<uint8_t *>(this) + sizeof(*this), reinterpret_cast<uint8_t *>(std::addressof(o)));
     }
     hllbase_t(const hllbase_t &other): core_(other.core_), value_(other.value_), np_(other.np_), is_calculated_(other.is_calculated_),
-        estim_(other.estim_), jestim_(other.jestim_), hf_(other.hf_)
-    {
-#if LZ_COUNTER
-        std::memcpy(&clz_counts_[0], &other.clz_counts_[0], sizeof(clz_counts_));
-#endif
-    }
+        estim_(other.estim_), jestim_(other.jestim_), hf_(other.hf_) {}
     hllbase_t& operator=(const hllbase_t &other) {
         // Explicitly define to make sure we don't do unnecessary reallocation.
         if(core_.size() != other.core_.size()) core_.resize(other.core_.size());
@@ -968,6 +1267,7 @@ public:
         }
 #endif
         not_ready();
+        if(stats::enabled()) stats::add(stats::MERGES);
         return *this;
     }
 
@@ -1004,6 +1304,7 @@ public:
     }
     const auto &core()    const {return core_;}
     const uint8_t *data() const {return core_.data();}
+    uint8_t *data() {return core_.data();} // Allows conversion from other register encodings.
 
     uint32_t p() const {return np_;}
     uint32_t q() const {return (sizeof(uint64_t) * CHAR_BIT) - np_;}
@@ -1100,16 +1401,9 @@ public:
     double union_size(const hllbase_t &other) const {
         if(jestim_ != JointEstimationMethod::ERTL_JOINT_MLE) {
             assert(m() == other.m());
-            std::array<uint32_t, 64> counts{0};
-            // We can do this because we use an aligned allocator.
-            // We also have found that wider vectors than SSE2 don't matter
-            const __m128i *p1(reinterpret_cast<const __m128i *>(data())), *p2(reinterpret_cast<const __m128i *>(other.data()));
-            const __m128i *const pe(reinterpret_cast<const __m128i *>(&(*core().cend())));
-            for(__m128i tmp;p1 < pe;) {
-                tmp = _mm_max_epu8(*p1++, *p2++);
-                for(size_t i = 0; i < sizeof(tmp);++counts[reinterpret_cast<uint8_t *>(&tmp)[i++]]);
-            }
-            return detail::calculate_estimate(counts, get_estim(), m(), p(), alpha());
+            detail::byte_histogram_t<64> hist;
+            hist.add_max(data(), other.data(), m());
+            return detail::calculate_estimate(hist.counts(), get_estim(), m(), p(), alpha());
         }
         const auto full_counts = ertl_joint(*this, other);
         return full_counts[0] + full_counts[1] + full_counts[2];
@@ -1158,18 +1452,37 @@ public:
     static constexpr unsigned min_size() {
         return ilog2(sizeof(detail::SIMDHolder));
     }
-#if LZ_COUNTER
-    ~hllbase_t() {
-        std::string tmp;
-        for(const auto &val: clz_counts_) tmp += std::to_string(val), tmp += ',';
-        tmp.pop_back();
-        std::fprintf(stderr, "counts: %s\n", tmp.data());
-    }
-#endif
 };
 
 using hll_t = hllbase_t<>;
 
+namespace detail {
+template<typename HllType>
+struct compress_data_t {
+    HllType *hlls_;
+    size_t  new_np_;
+};
+template<typename HllType>
+void compress_helper(void *data_, long i, int tid) {
+    const compress_data_t<HllType> &data(*reinterpret_cast<const compress_data_t<HllType> *>(data_));
+    data.hlls_[i].compress_inplace(data.new_np_);
+}
+} // namespace detail
+
+// Reduces n sketches to 2**new_np registers each, in place and in parallel.
+template<typename HashStruct>
+void compress_inplace(hllbase_t<HashStruct> *hlls, size_t n, size_t new_np, int nthreads=-1) {
+    for(size_t i = 0; i < n; ++i)
+        if(new_np > hlls[i].p())
+            throw std::runtime_error(std::string("Can't compress to a larger size. Current: ") + std::to_string(hlls[i].p()) + ". Requested new size: " + std::to_string(new_np));
+    detail::compress_data_t<hllbase_t<HashStruct>> data{hlls, new_np};
+    kt_for(nthreads > 0 ? nthreads: int(std::thread::hardware_concurrency()), detail::compress_helper<hllbase_t<HashStruct>>, &data, n);
+}
+template<typename HashStruct>
+void compress_inplace(std::vector<hllbase_t<HashStruct>> &hlls, size_t new_np, int nthreads=-1) {
+    compress_inplace(hlls.data(), hlls.size(), new_np, nthreads);
+}
+
 // Returns the size of the set intersection
 template<typename HllType>
 inline double intersection_size(HllType &first, HllType &other) noexcept {
@@ -1342,179 +1655,568 @@ public:
 };
 using seedhll_t = seedhllbase_t<>;
 
-template<typename SeedHllType=hll_t>
-class hlfbase_t {
-protected:
-    // Note: Consider using a shared buffer and then do a weighted average
-    // of estimates from subhlls of power of 2 sizes.
-    std::vector<SeedHllType>                      hlls_;
-    std::vector<uint64_t, Allocator<uint64_t>>   seeds_;
-    std::vector<double>                         values_;
-    mutable double                               value_;
-    bool                                 is_calculated_;
-    using HashType     = typename SeedHllType::HashType;
+template<typename HashStruct=WangHash>
+class shardhllbase_t: private hllbase_t<HashStruct> {
+    // shardhllbase_t gives each writer thread a private register array, which it updates without read-modify-write atomics.
+    // Shards are lazily max-merged into the base sketch's registers when the sketch is queried,
+    // so concurrent insertion never bounces a shared cache line between cores.
+    // Writers identify themselves by a thread id in [0, nshards()), e.g., the tid passed by kt_for.
+    // Shard registers are written and merged with relaxed atomic byte loads and stores (plain moves on x86),
+    // so queries may run while writers are active. Queries are serialized by a mutex guarding the base registers.
+    // The base is private, since its registers are stale until merged: only accessors which merge first are exposed,
+    // and finalize() returns a plain hllbase_t for everything else.
+    using hll_t = hllbase_t<HashStruct>;
+    struct alignas(64) shard_t {
+        // Aligned so that neighboring shards' dirty flags sit on separate cache lines.
+        std::vector<uint8_t, Allocator<uint8_t>> regs_;
+        std::atomic<uint8_t>                    dirty_;
+        shard_t(): dirty_(0) {}
+    };
+    std::vector<shard_t, sse::AlignedAllocator<shard_t, sse::Alignment::KL>> shards_;
+    mutable std::mutex merge_mutex_;
+
+    static INLINE uint8_t load_reg(const uint8_t *p) {return __atomic_load_n(p, __ATOMIC_RELAXED);}
+    static INLINE void store_reg(uint8_t *p, uint8_t v) {__atomic_store_n(p, v, __ATOMIC_RELAXED);}
+    void merge_locked() {
+        uint8_t *const core = this->core_.data();
+        const size_t m = this->core_.size();
+        for(auto &s: shards_) {
+            if(!s.dirty_.exchange(0, std::memory_order_acquire)) continue;
+            const uint8_t *const regs = s.regs_.data();
+            for(size_t i = 0; i < m; ++i) core[i] = std::max(core[i], load_reg(regs + i));
+            this->not_ready();
+        }
+    }
+    // Locks both sketches' base registers without deadlocking when two threads compare them in opposite orders.
+    std::pair<std::unique_lock<std::mutex>, std::unique_lock<std::mutex>> lock_with(shardhllbase_t &o) {
+        std::unique_lock<std::mutex> a(merge_mutex_, std::defer_lock), b;
+        if(&o == this) a.lock();
+        else b = std::unique_lock<std::mutex>(o.merge_mutex_, std::defer_lock), std::lock(a, b);
+        return std::make_pair(std::move(a), std::move(b));
+    }
 public:
     template<typename... Args>
-    hlfbase_t(size_t size, uint64_t seedseed, Args &&... args): value_(0), is_calculated_(0) {
-        auto sfs = detail::seeds_from_seed(seedseed, size);
-        assert(sfs.size());
-        hlls_.reserve(size);
-        for(const auto seed: sfs) seeds_.emplace_back(seed);
-        while(hlls_.size() < seeds_.size()) hlls_.emplace_back(std::forward<Args>(args)...);
+    shardhllbase_t(size_t nshards, size_t np, Args &&...args): hll_t(np, std::forward<Args>(args)...), shards_(nshards) {
+        if(nshards == 0) throw std::runtime_error("shardhllbase_t requires at least one shard.");
+        for(auto &s: shards_) s.regs_.resize(this->m());
+    }
+    shardhllbase_t(const shardhllbase_t &) = delete;
+    shardhllbase_t(shardhllbase_t &&o): hll_t(std::move(o)), shards_(std::move(o.shards_)) {}
+    using typename hll_t::HashType;
+    using hll_t::p;
+    using hll_t::q;
+    using hll_t::m;
+    using hll_t::size;
+    using hll_t::get_estim;
+    using hll_t::get_jestim;
+    size_t nshards() const {return shards_.size();}
+
+    INLINE void add(uint64_t hashval, unsigned tid) {
+        assert(tid < shards_.size());
+        shard_t &s = shards_[tid];
+        const uint32_t index(hashval >> this->q());
+        const uint8_t lzt(clz(((hashval << 1)|1) << (this->np_ - 1)) + 1);
+        if(load_reg(&s.regs_[index]) < lzt) {
+            store_reg(&s.regs_[index], lzt);
+            s.dirty_.store(1, std::memory_order_release);
+        }
     }
-    hlfbase_t(const hlfbase_t &) = default;
-    hlfbase_t(hlfbase_t &&) = default;
-    uint64_t size() const {return hlls_.size();}
-    auto m() const {return hlls_[0].size();}
-    void write(const char *fn) const {
-        gzFile fp = gzopen(fn, "wb");
-        if(fp == nullptr) throw std::runtime_error("Could not open file.");
-        this->write(fp);
-        gzclose(fp);
+    INLINE void addh(uint64_t element, unsigned tid) {add(this->hf_(element), tid);}
+    void add_batch(const uint64_t *hashes, size_t n, unsigned tid) {
+        assert(tid < shards_.size());
+        shard_t &s = shards_[tid];
+        uint8_t *const regs = s.regs_.data();
+        uint32_t indices[detail::BATCH_SIZE];
+        uint8_t  ranks[detail::BATCH_SIZE];
+        bool changed = false;
+        for(size_t i = 0; i < n; i += detail::BATCH_SIZE) {
+            const size_t nb = std::min(n - i, detail::BATCH_SIZE);
+            detail::hashes2regs(hashes + i, indices, ranks, nb, this->np_);
+            for(size_t j = 0; j < nb; __builtin_prefetch(regs + indices[j++], 1));
+            for(size_t j = 0; j < nb; ++j) {
+                if(load_reg(regs + indices[j]) < ranks[j]) store_reg(regs + indices[j], ranks[j]), changed = true;
+            }
+        }
+        if(changed) s.dirty_.store(1, std::memory_order_release);
+    }
+
+    // Folds every shard written to since the last merge into the base registers.
+    // May run while writers are active; their later updates are picked up by the next merge.
+    void merge() {
+        std::lock_guard<std::mutex> lock(merge_mutex_);
+        merge_locked();
     }
+    void sum() {std::lock_guard<std::mutex> lock(merge_mutex_); merge_locked(); hll_t::sum();}
+    void csum() {std::lock_guard<std::mutex> lock(merge_mutex_); merge_locked(); hll_t::csum();}
+    double report() {
+        std::lock_guard<std::mutex> lock(merge_mutex_);
+        merge_locked();
+        hll_t::csum();
+        return hll_t::creport();
+    }
+    double cardinality_estimate() {return report();}
+    double creport() {return report();}
+    std::string to_string() {
+        std::lock_guard<std::mutex> lock(merge_mutex_);
+        merge_locked();
+        hll_t::csum();
+        return hll_t::to_string();
+    }
+    // Serializes the merged registers in hllbase_t's format.
+    void write(gzFile fp) {std::lock_guard<std::mutex> lock(merge_mutex_); merge_locked(); hll_t::write(fp);}
+    void write(const char *path, bool write_gz=true) {std::lock_guard<std::mutex> lock(merge_mutex_); merge_locked(); hll_t::write(path, write_gz);}
+    // Returns a plain hllbase_t holding the merged registers, e.g., for serialization or comparison.
+    hll_t finalize() {
+        std::lock_guard<std::mutex> lock(merge_mutex_);
+        merge_locked();
+        return static_cast<const hll_t &>(*this);
+    }
+    double union_size(shardhllbase_t &o) {auto locks = lock_with(o); merge_locked(); o.merge_locked(); return hll_t::union_size(o);}
+    double union_size(const hll_t &o) {std::lock_guard<std::mutex> lock(merge_mutex_); merge_locked(); return hll_t::union_size(o);}
+    double jaccard_index(shardhllbase_t &o) {
+        auto locks = lock_with(o);
+        merge_locked(), o.merge_locked();
+        hll_t::csum(), o.hll_t::csum();
+        return hll_t::jaccard_index(static_cast<const hll_t &>(o));
+    }
+    double jaccard_index(const hll_t &o) {std::lock_guard<std::mutex> lock(merge_mutex_); merge_locked(); hll_t::csum(); return hll_t::jaccard_index(o);}
+    double containment_index(shardhllbase_t &o) {
+        auto locks = lock_with(o);
+        merge_locked(), o.merge_locked();
+        hll_t::csum(), o.hll_t::csum();
+        return hll_t::containment_index(o);
+    }
+    double containment_index(const hll_t &o) {std::lock_guard<std::mutex> lock(merge_mutex_); merge_locked(); hll_t::csum(); return hll_t::containment_index(o);}
+    // Unlike queries, clear() must not run while writers are active.
     void clear() {
-        value_ = is_calculated_ = 0;
-        for(auto &hll: hlls_) hll.clear();
+        std::lock_guard<std::mutex> lock(merge_mutex_);
+        hll_t::clear();
+        for(auto &s: shards_) {
+            std::memset(s.regs_.data(), 0, s.regs_.size());
+            s.dirty_.store(0, std::memory_order_relaxed);
+        }
     }
-    void read(const char *fn) {
-        gzFile fp = gzopen(fn, "rb");
-        if(fp == nullptr) throw std::runtime_error("Could not open file.");
-        this->read(fp);
-        gzclose(fp);
+    void reset() {clear();}
+    std::pair<size_t, size_t> est_memory_usage() const {
+        return std::make_pair(sizeof(*this) + shards_.size() * sizeof(shard_t),
+                              (shards_.size() + 1) * this->core_.size());
     }
-    void write(gzFile fp) const {
-        uint64_t sz = hlls_.size();
-        gzwrite(fp, &sz, sizeof(sz));
-        for(auto &seed: seeds_) gzwrite(fp, &seed, sizeof(seed));
-        for(const auto &hll: hlls_) {
-            hll.write(fp);
+};
+using shardhll_t = shardhllbase_t<>;
+
+template<typename HashStruct=WangHash>
+class histhllbase_t: private hllbase_t<HashStruct> {
+    // histhllbase_t keeps the histogram of register values up to date as registers increase,
+    // so that report() only needs to run the estimator over 64 counts instead of rescanning all registers.
+    // This suits workloads which alternate between small numbers of insertions and queries.
+    // hllbase_t's update methods are not virtual, so an update through an hllbase_t & would skip the histogram.
+    // The base is therefore private: as_hll() gives read-only access for comparisons, serialization and the like.
+    using hll_t = hllbase_t<HashStruct>;
+    std::array<uint32_t, 64> counts_;
+    INLINE void update(uint32_t index, uint8_t lzt) {
+#ifndef NOT_THREADSAFE
+        for(uint8_t old; (old = this->core_[index]) < lzt;) {
+            if(__sync_bool_compare_and_swap(this->core_.data() + index, old, lzt)) {
+                __sync_fetch_and_sub(&counts_[old], 1);
+                __sync_fetch_and_add(&counts_[lzt], 1);
+                this->not_ready();
+                break;
+            }
         }
-        gzclose(fp);
+#else
+        const uint8_t old = this->core_[index];
+        if(old < lzt) {
+            --counts_[old];
+            ++counts_[lzt];
+            this->core_[index] = lzt;
+            this->not_ready();
+        }
+#endif
     }
-    void read(gzFile fp) {
-        uint64_t size;
-        gzread(fp, &size, sizeof(size));
-        seeds_.resize(size);
-        for(unsigned i(0); i < size; gzread(fp, seeds_.data() + i++, sizeof(seeds_[0])));
-        hlls_.clear();
-        while(hlls_.size() < size) hlls_.emplace_back(fp);
-        gzclose(fp);
+public:
+    using final_type = histhllbase_t<HashStruct>;
+    using typename hll_t::HashType;
+    using hll_t::p;
+    using hll_t::q;
+    using hll_t::m;
+    using hll_t::size;
+    using hll_t::core;
+    using hll_t::data;
+    using hll_t::alpha;
+    using hll_t::min_size;
+    using hll_t::get_estim;
+    using hll_t::get_jestim;
+    using hll_t::set_estim;
+    using hll_t::set_jestim;
+    using hll_t::get_is_ready;
+    using hll_t::not_ready;
+    using hll_t::may_contain;
+    using hll_t::est_memory_usage;
+    using hll_t::to_string;
+    using hll_t::desc_string;
+    using hll_t::printf;
+    using hll_t::sprintf;
+    using hll_t::write;
+    using hll_t::compress;
+    using hll_t::union_size;
+    using hll_t::jaccard_index;
+    using hll_t::containment_index;
+
+    histhllbase_t(): hll_t() {rebuild_counts();}
+    // Forwards to hllbase_t's constructors, but never stands in for histhllbase_t's own copy and move constructors.
+    template<typename First, typename... Args,
+             typename=std::enable_if_t<!std::is_base_of<histhllbase_t, std::decay_t<First>>::value>>
+    explicit histhllbase_t(First &&first, Args &&...args): hll_t(std::forward<First>(first), std::forward<Args>(args)...) {rebuild_counts();}
+    const hll_t &as_hll() const {return *this;}
+    // Recomputes the histogram from the registers, which is only required after modifying them directly.
+    void rebuild_counts() {
+        if(this->core_.size() >= sizeof(detail::SIMDHolder)) counts_ = detail::sum_counts(this->core_);
+        else {
+            std::fill(counts_.begin(), counts_.end(), 0u);
+            for(const auto v: this->core_) ++counts_[v];
+        }
     }
+    const std::array<uint32_t, 64> &counts() const {return counts_;}
 
-    // This only works for hlls using 64-bit integers.
-    // Looking ahead,consider templating so that the double version might be helpful.
-
-    bool may_contain(uint64_t element) const {
-        unsigned k = 0;
-        if(size() >= Space::COUNT) {
-            if(size() & (size() - 1)) throw NotImplementedError("supporting a non-power of two.");
-            const Type *sptr = reinterpret_cast<const Type *>(&seeds_[0]);
-            const Type *eptr = reinterpret_cast<const Type *>(&seeds_[seeds_.size()]);
-            VType key;
-            do {
-                key = WangHash()(*sptr++ ^ Space::set1(element));
-                for(unsigned i(0); i < Space::COUNT;) if(!hlls_[k++].may_contain(key.arr_[i++])) return false;
-            } while(sptr < eptr);
-            return true;
-        } else { // if size() >= Space::COUNT
-            for(unsigned i(0); i < size(); ++i) if(!hlls_[i].may_contain(WangHash()(element ^ seeds_[i]))) return false;
-            return true;
+    INLINE void add(uint64_t hashval) {
+        update(hashval >> this->q(), clz(((hashval << 1)|1) << (this->np_ - 1)) + 1);
+    }
+    INLINE void addh(uint64_t element) {add(this->hf_(element));}
+    INLINE void addh(const std::string &element) {add(hash::XXH3Hasher()(element));}
+    INLINE void addh(VType element) {
+        element = this->hf_(element.simd_);
+        add(element);
+    }
+    INLINE void add(VType element) {
+        element.for_each([&](uint64_t &val) {add(val);});
+    }
+    template<typename T, typename Hasher=std::hash<T>>
+    INLINE void adds(const T element, const Hasher &hasher) {add(hasher(element));}
+    void add_batch(const uint64_t *hashes, size_t n) {
+        uint32_t indices[detail::BATCH_SIZE];
+        uint8_t  ranks[detail::BATCH_SIZE];
+        for(size_t i = 0; i < n; i += detail::BATCH_SIZE) {
+            const size_t nb = std::min(n - i, detail::BATCH_SIZE);
+            detail::hashes2regs(hashes + i, indices, ranks, nb, this->np_);
+            for(size_t j = 0; j < nb; __builtin_prefetch(this->core_.data() + indices[j++], 1));
+            for(size_t j = 0; j < nb; ++j) update(indices[j], ranks[j]);
         }
     }
-    void addh(uint64_t val) {
-        unsigned k = 0;
-        if(size() >= Space::COUNT) {
-            if(size() & (size() - 1)) throw NotImplementedError("supporting a non-power of two.");
-            const Type *sptr = reinterpret_cast<const Type *>(&seeds_[0]);
-            const Type *eptr = reinterpret_cast<const Type *>(&seeds_[seeds_.size()]);
-            const Type element = Space::set1(val);
-            VType key;
-            do {
-                key = WangHash()(*sptr++ ^ element);
-                for(unsigned i(0) ; i < Space::COUNT; hlls_[k++].add(key.arr_[i++]));
-                assert(k <= size());
-            } while(sptr < eptr);
-        } else while(k < size()) hlls_[k].add(WangHash()(val ^ seeds_[k])), ++k;
+    void addh_batch(const uint64_t *vals, size_t n) {
+        this->hash_blocks(vals, n, [this](const uint64_t *hashes, size_t nb) {add_batch(hashes, nb);});
     }
-    double creport() const {
-        if(is_calculated_) return value_;
-        double ret(hlls_[0].creport());
-        for(size_t i(1); i < size(); ret += hlls_[i++].creport());
-        ret /= static_cast<double>(size());
-        value_ = ret;
-        return value_ = ret;
+    template<typename Container>
+    void add_batch(const Container &con) {add_batch(con.data(), con.size());}
+    template<typename Container>
+    void addh_batch(const Container &con) {addh_batch(con.data(), con.size());}
+
+    void sum() {
+        this->value_ = detail::calculate_estimate(counts_, this->estim_, this->m(), this->np_, this->alpha());
+        this->is_calculated_ = 1;
     }
-    hlfbase_t &operator+=(const hlfbase_t &other) {
-        if(other.size() != size()) throw std::runtime_error("Wrong number of subsketches.");
-        if(other.hlls_[0].p() != hlls_[0].p()) throw std::runtime_error("Wrong size of subsketches.");
-        for(unsigned i(0); i < size(); ++i) {
-            hlls_[i] += other.hlls_[i];
-            hlls_[i].not_ready();
+    void csum() {if(!this->is_calculated_) sum();}
+    double creport() const {
+        if(!this->is_calculated_) {
+            this->value_ = detail::calculate_estimate(counts_, this->estim_, this->m(), this->np_, this->alpha());
+            this->is_calculated_ = true;
         }
-        is_calculated_ = false;
+        return this->value_;
     }
-    hlfbase_t operator+(const hlfbase_t &other) const {
-        // Could be more directly optimized.
-        hlfbase_t ret = *this;
+    double report() noexcept {
+        csum();
+        return creport();
+    }
+    double cardinality_estimate() const {return creport();}
+    double cardinality_estimate() noexcept {return report();}
+
+    histhllbase_t &operator+=(const hll_t &other) {
+        hll_t::operator+=(other);
+        rebuild_counts();
+        return *this;
+    }
+    histhllbase_t &operator+=(const histhllbase_t &other) {return *this += other.as_hll();}
+    histhllbase_t operator+(const hll_t &other) const {
+        histhllbase_t ret(*this);
         ret += other;
+        return ret;
     }
-    double jaccard_index(const hlfbase_t &other) const {
-        double est = chunk_report();
-        est += other.chunk_report();
-        hlfbase_t tmp = *this + other;
-        double uest = tmp.chunk_report();
-        double olap = est - uest;
-        olap /= uest;
-        return olap;
+    histhllbase_t operator+(const histhllbase_t &other) const {return *this + other.as_hll();}
+    bool operator==(const histhllbase_t &o) const {return as_hll() == o.as_hll();}
+    void clear() {
+        hll_t::clear();
+        rebuild_counts();
     }
-    double report() noexcept {
-        if(is_calculated_) return value_;
-        hlls_[0].csum();
-#if DIVIDE_EVERY_TIME
-        double ret(hlls_[0].report() / static_cast<double>(size()));
-        for(size_t i(1); i < size(); ++i) {
-            hlls_[i].csum();
-            ret += hlls_[i].report() / static_cast<double>(size());
+    void reset() {clear();}
+    void resize(size_t new_size) {
+        hll_t::resize(new_size);
+        rebuild_counts();
+    }
+    template<typename T>
+    void read(T &&arg) {
+        hll_t::read(std::forward<T>(arg));
+        rebuild_counts();
+    }
+};
+using histhll_t = histhllbase_t<>;
+
+template<typename HashStruct=WangHash>
+class hlfbase_t {
+// HyperLogFilter: size() HyperLogLogs of the same precision, each fed by a different seeded hash of every element.
+// Sub-sketch k takes both its register index and its rank from hf_(element ^ seed k), so the sub-sketches are independent
+// and averaging their estimates reduces the variance. Every sub-sketch's registers are stored one after another
+// in a single aligned buffer. An insertion hashes all seeds with SIMD and prefetches every register it will update
+// before updating any, so the per-sub-sketch cache misses overlap. It still touches size() cache lines:
+// sharing one row of registers across sub-sketches would take that down to one or two, but correlates their estimates.
+// The serialized format starts with HLF_MAGIC and a version number; files written before the version was added
+// hold one serialized hllbase_t per sub-sketch, and are still read.
+protected:
+    std::vector<uint8_t, Allocator<uint8_t>>      core_;
+    std::vector<uint64_t, Allocator<uint64_t>>   seeds_; // Padded to a multiple of the vector width
+    size_t                                        size_;
+    mutable double                               value_;
+    uint32_t                                        np_;
+    mutable bool                         is_calculated_;
+    EstimationMethod                             estim_;
+    JointEstimationMethod                       jestim_;
+    HashStruct                                      hf_;
+
+    static constexpr uint64_t HLF_MAGIC = 0x4843544b53464c48ull; // "HLFSKTCH"
+    static constexpr uint32_t HLF_VERSION = 2;
+
+    void pad_seeds() {
+        seeds_.resize((size_ + Space::COUNT - 1) / Space::COUNT * Space::COUNT, seeds_.back());
+    }
+    // Calls func(positions, ranks, n) with the positions in core_ of val's registers in sub-sketches [k, k + n) and their ranks,
+    // for each block of up to BATCH_SIZE sub-sketches, stopping early if func returns false.
+    template<typename Func>
+    bool for_each_register_block(uint64_t val, const Func &func) const {
+        static_assert(detail::BATCH_SIZE % Space::COUNT == 0, "Batch size must be a multiple of the vector width");
+        alignas(sizeof(Type)) uint64_t buf[detail::BATCH_SIZE];
+        uint32_t indices[detail::BATCH_SIZE];
+        uint8_t ranks[detail::BATCH_SIZE];
+        size_t positions[detail::BATCH_SIZE];
+        const Type element = Space::set1(val);
+        const Type *sptr = reinterpret_cast<const Type *>(seeds_.data());
+        for(size_t k = 0; k < size_; k += detail::BATCH_SIZE) {
+            const size_t nb = std::min(size_ - k, detail::BATCH_SIZE);
+            for(size_t j = 0; j < nb; j += Space::COUNT) Space::store(reinterpret_cast<Type *>(buf + j), hf_(*sptr++ ^ element));
+            detail::hashes2regs(buf, indices, ranks, nb, np_);
+            for(size_t j = 0; j < nb; ++j) {
+                positions[j] = ((k + j) << np_) + indices[j];
+                __builtin_prefetch(core_.data() + positions[j]);
+            }
+            if(!func(positions, ranks, nb)) return false;
         }
-#else
-        double ret(hlls_[0].report());
-        for(size_t i(1); i < size(); ++i) {
-            hlls_[i].csum();
-            ret += hlls_[i].report();
+        return true;
+    }
+    // Reads the format written before HLF_MAGIC was added, whose sub-sketches are hashed the same way, given its first field.
+    void read_legacy(gzFile fp, uint64_t sz) {
+        seeds_.resize(sz);
+        common::io::gzread_all(fp, seeds_.data(), sz * sizeof(seeds_[0]));
+        size_ = sz;
+        for(size_t k = 0; k < size_; ++k) {
+            hllbase_t<HashStruct> sub;
+            sub.read(fp);
+            if(k == 0) {
+                np_ = sub.p();
+                estim_ = sub.get_estim();
+                jestim_ = sub.get_jestim();
+                core_.resize(m() * size_);
+            } else if(sub.p() != np_) throw std::runtime_error("Serialized hlfbase_t's sub-sketches differ in size.");
+            std::memcpy(core_.data() + (k << np_), sub.data(), m());
         }
-        ret /= static_cast<double>(size());
-#endif
-        return value_ = ret;
     }
+    void check_compatible(const hlfbase_t &other) const {
+        if(other.size_ != size_) throw std::runtime_error("Wrong number of subsketches.");
+        if(other.np_ != np_) throw std::runtime_error("Wrong size of subsketches.");
+        if(!std::equal(seeds_.begin(), seeds_.begin() + size_, other.seeds_.begin()))
+            throw std::runtime_error("Sketches were built with different seeds.");
+    }
+    double chunk_estimate(const std::array<uint32_t, 64> &counts) const {
+        const auto diff = (sizeof(uint32_t) * CHAR_BIT - clz(uint32_t(size_)) - 1);
+        const auto new_p = np_ + diff;
+        const auto new_m = (1ull << new_p);
+        return detail::calculate_estimate(counts, estim_, new_m, new_p, make_alpha(new_m)) / (1ull << diff);
+    }
+public:
+    template<typename... Args>
+    hlfbase_t(size_t size, uint64_t seedseed, unsigned np, EstimationMethod estim=ERTL_MLE,
+              JointEstimationMethod jestim=ERTL_JOINT_MLE, Args &&... args):
+        core_((size_t(1) << np) * size), size_(size), value_(0), np_(np), is_calculated_(0),
+        estim_(estim), jestim_(jestim), hf_(std::forward<Args>(args)...)
+    {
+        if(size == 0) throw std::runtime_error("hlfbase_t requires at least one subsketch.");
+        auto sfs = detail::seeds_from_seed(seedseed, size);
+        seeds_.assign(sfs.begin(), sfs.end());
+        pad_seeds();
+    }
+    explicit hlfbase_t(const char *path): size_(0), value_(0), np_(0), is_calculated_(0) {read(path);}
+    hlfbase_t(const hlfbase_t &) = default;
+    hlfbase_t(hlfbase_t &&) = default;
+    hlfbase_t &operator=(const hlfbase_t &) = default;
+    hlfbase_t &operator=(hlfbase_t &&) = default;
+    uint64_t size() const {return size_;}
+    uint64_t m() const {return uint64_t(1) << np_;}
+    uint32_t p() const {return np_;}
+    uint32_t q() const {return (sizeof(uint64_t) * CHAR_BIT) - np_;}
+    const auto &core() const {return core_;}
+    const uint64_t *seeds() const {return seeds_.data();}
+    EstimationMethod get_estim()       const {return  estim_;}
+    JointEstimationMethod get_jestim() const {return jestim_;}
+    // Register `index` of sub-sketch k
+    uint8_t reg(size_t k, size_t index) const {return core_[(k << np_) + index];}
+    // Sub-sketch k's registers
+    const uint8_t *sub_data(size_t k) const {return core_.data() + (k << np_);}
+    // Copies sub-sketch k into a standalone sketch.
+    hllbase_t<HashStruct> sub_hll(size_t k) const {
+        hllbase_t<HashStruct> ret(np_, estim_, jestim_);
+        std::memcpy(ret.data(), sub_data(k), m());
+        return ret;
+    }
+    void clear() {
+        value_ = is_calculated_ = 0;
+        std::fill(core_.begin(), core_.end(), uint8_t(0));
+    }
+    void write(gzFile fp) const {
+        using common::io::gzwrite_all;
+        const uint64_t header[]{HLF_MAGIC, size_};
+        const uint32_t bf[]{HLF_VERSION, np_, estim_, jestim_};
+        gzwrite_all(fp, header, sizeof(header));
+        gzwrite_all(fp, bf, sizeof(bf));
+        gzwrite_all(fp, seeds_.data(), size_ * sizeof(seeds_[0]));
+        gzwrite_all(fp, core_.data(), core_.size());
+    }
+    void write(const char *path) const {common::io::write_path(*this, path);}
+    void read(gzFile fp) {
+        using common::io::gzread_all;
+        uint64_t sz;
+        gzread_all(fp, &sz, sizeof(sz));
+        if(sz == 0) throw std::runtime_error("Serialized hlfbase_t has no subsketches.");
+        if(sz != HLF_MAGIC) read_legacy(fp, sz);
+        else {
+            uint32_t bf[4];
+            gzread_all(fp, &sz, sizeof(sz));
+            gzread_all(fp, bf, sizeof(bf));
+            if(bf[0] != HLF_VERSION)
+                throw std::runtime_error(std::string("Unsupported serialized hlfbase_t version ") + std::to_string(bf[0]));
+            if(sz == 0 || bf[1] < 2 || bf[1] > 32 || bf[2] > ERTL_MLE || bf[3] > ERTL_JOINT_MLE)
+                throw std::runtime_error("Invalid header for serialized hlfbase_t.");
+            size_ = sz;
+            np_ = bf[1];
+            estim_  = static_cast<EstimationMethod>(bf[2]);
+            jestim_ = static_cast<JointEstimationMethod>(bf[3]);
+            seeds_.resize(sz);
+            gzread_all(fp, seeds_.data(), sz * sizeof(seeds_[0]));
+            core_.resize(m() * size_);
+            gzread_all(fp, core_.data(), core_.size());
+        }
+        pad_seeds();
+        value_ = is_calculated_ = 0;
+    }
+    void read(const char *path) {common::io::read_path(*this, path);}
 
-    double med_report() noexcept {
-        double *values = static_cast<double *>(size() < 100000u ? __builtin_alloca(size() * sizeof(double)): std::malloc(size() * sizeof(double))), *p = values;
-        for(auto it = hlls_.begin(); it != hlls_.end(); *p++ = it->report(), ++it);
-        if(size() < 32) {
-            sort::insertion_sort(values, values + size());
-            return .5 * (values[size() >> 1] + values[(size() >> 1) - 1]);
+    bool may_contain(uint64_t val) const {
+        return for_each_register_block(val, [this](const size_t *positions, const uint8_t *ranks, size_t n) {
+            const uint8_t *const regs = core_.data();
+            unsigned missing = 0;
+            for(size_t j = 0; j < n; ++j) missing |= ranks[j] > regs[positions[j]];
+            return missing == 0;
+        });
+    }
+    void addh(uint64_t val) {
+        const bool record = stats::enabled();
+        for_each_register_block(val, [this,record](const size_t *positions, const uint8_t *ranks, size_t n) {
+            uint8_t *const regs = core_.data();
+            unsigned updates = 0, retries = 0;
+            for(size_t j = 0; j < n; ++j) {
+#ifndef NOT_THREADSAFE
+                updates += detail::cas_max(regs + positions[j], ranks[j], retries);
+#else
+                updates += regs[positions[j]] < ranks[j];
+                regs[positions[j]] = std::max(regs[positions[j]], ranks[j]);
+#endif
+            }
+            if(record) stats::add_inserts(ranks, n, updates, retries);
+            return true;
+        });
+    }
+    // Register histograms of every sub-sketch
+    std::vector<std::array<uint32_t, 64>> sub_counts() const {
+        std::vector<std::array<uint32_t, 64>> ret(size_);
+        detail::byte_histogram_t<64> hist;
+        for(size_t k = 0; k < size_; ++k) {
+            hist.clear();
+            hist.add(sub_data(k), m());
+            ret[k] = hist.counts();
         }
-        std::nth_element(values, values + (size() >> 1) - 1, values + size());
-        double ret = .5 * (values[(size() >> 1) - 1] + values[(size() >> 1)]);
-        if(hlls_.size() >= 100000u) std::free(values);
         return ret;
     }
+    std::vector<double> sub_estimates() const {
+        const auto counts = sub_counts();
+        std::vector<double> ret(size_);
+        for(size_t k = 0; k < size_; ++k) ret[k] = detail::calculate_estimate(counts[k], estim_, m(), np_, make_alpha(m()));
+        return ret;
+    }
+    // Mean of the sub-sketches' estimates
+    double creport() const {
+        if(is_calculated_) return value_;
+        double sum = 0.;
+        for(const double est: sub_estimates()) sum += est;
+        value_ = sum / static_cast<double>(size_);
+        is_calculated_ = true;
+        return value_;
+    }
+    double report() const noexcept {return creport();}
+    // Median of the sub-sketches' estimates
+    double med_report() const {
+        auto ests = sub_estimates();
+        const size_t mid = size_ >> 1;
+        std::nth_element(ests.begin(), ests.begin() + mid, ests.end());
+        if(size_ & 1) return ests[mid];
+        return .5 * (*std::max_element(ests.begin(), ests.begin() + mid) + ests[mid]);
+    }
     // Attempt strength borrowing across hlls with different seeds
     double chunk_report() const {
-        if(__builtin_expect((size() & (size() - 1)) == 0, 1)) {
-            std::array<uint32_t, 64> counts{0};
-            for(const auto &hll: hlls_) detail::inc_counts(counts, hll.core());
-            const auto diff = (sizeof(uint32_t) * CHAR_BIT - clz(uint32_t(size())) - 1);
-            const auto new_p = hlls_[0].p() + diff;
-            const auto new_m = (1ull << new_p);
-            return detail::calculate_estimate(counts, hlls_[0].get_estim(), new_m,
-                                              new_p, make_alpha(new_m)) / (1ull << diff);
+        if(__builtin_expect((size_ & (size_ - 1)) == 0, 1)) {
+            detail::byte_histogram_t<64> hist;
+            hist.add(core_.data(), core_.size());
+            return chunk_estimate(hist.counts());
         } else {
             std::fprintf(stderr, "chunk_report is currently only supported for powers of two.");
             return creport();
             // Could try weight averaging, but currently I just report default when size is not a power of two.
         }
     }
+    hlfbase_t &operator+=(const hlfbase_t &other) {
+        check_compatible(other);
+        size_t i = 0;
+        for(const size_t nv = core_.size() / sizeof(Type) * sizeof(Type); i < nv; i += sizeof(Type)) {
+            Type *const dst = reinterpret_cast<Type *>(&core_[i]);
+            Space::store(dst, detail::SIMDHolder::max_fn(*dst, *reinterpret_cast<const Type *>(&other.core_[i])));
+        }
+        for(; i < core_.size(); ++i) core_[i] = std::max(core_[i], other.core_[i]);
+        is_calculated_ = false;
+        if(stats::enabled()) stats::add(stats::MERGES);
+        return *this;
+    }
+    hlfbase_t operator+(const hlfbase_t &other) const {
+        hlfbase_t ret = *this;
+        ret += other;
+        return ret;
+    }
+    double jaccard_index(const hlfbase_t &other) const {
+        check_compatible(other);
+        const bool pow2 = (size_ & (size_ - 1)) == 0;
+        const double est = pow2 ? chunk_report() + other.chunk_report(): creport() + other.creport();
+        double uest;
+        if(pow2) {
+            // The union's histogram is gathered without materializing the union.
+            detail::byte_histogram_t<64> hist;
+            hist.add_max(core_.data(), other.core_.data(), core_.size());
+            uest = chunk_estimate(hist.counts());
+        } else uest = (*this + other).creport();
+        return (est - uest) / uest;
+    }
 };
 using hlf_t = hlfbase_t<>;
 
@@ -1674,16 +2376,11 @@ struct wh119_t {
     }
     wh119_t(const std::vector<uint8_t, Allocator<uint8_t>> &s, long double base): core_(s), wh_base_(base) {}
     double cardinality_estimate() const {
-        std::array<uint32_t, 256> counts{0};
         if(core_.size() & (core_.size() - 1)) throw 1;
         if(core_.size() < sizeof(hll::detail::SIMDHolder)) throw 1;
-#if 1
-        hll::detail::SIMDHolder tmp, *ptr = (hll::detail::SIMDHolder*)core_.data();
-        for(size_t i = 0; i < core_.size() / sizeof(tmp); ++i)
-            (*ptr++).inc_counts(counts);
-#else
-        for(const auto v: core_) ++counts[v];
-#endif
+        hll::detail::byte_histogram_t<256> hist;
+        hist.add(core_.data(), core_.size());
+        const auto counts = hist.counts();
         long double sum = counts[0];
         for(ssize_t i = 1; i < ssize_t(counts.size()); ++i) {
             sum += static_cast<long double>(counts[i]) * (std::pow(wh_base_, -i));
@@ -1699,14 +2396,9 @@ struct wh119_t {
     double union_size(const wh119_t &o) const {return union_size(o.core_);}
     double union_size(const std::vector<uint8_t, Allocator<uint8_t>> &o) const {
         if(o.size() != size()) throw std::runtime_error("Non-matching parameters for wh119_t");
-        std::array<uint32_t, 256> counts;
-        std::memset(counts.data(), 0, sizeof(counts));
-        size_t i;
-        using space = vec::SIMDTypes<uint8_t>;
-        const space::Type *p1 = (const space::Type *)core_.data(), *p2 = (const space::Type *)o.data();
-        for(i = 0; i < core_.size() / sizeof(*p1); ++i) {
-            hll::detail::SIMDHolder(hll::detail::SIMDHolder::max_fn(*p1++, *p2++)).inc_counts(counts);
-        }
+        hll::detail::byte_histogram_t<256> hist;
+        hist.add_max(core_.data(), o.data(), core_.size());
+        const auto counts = hist.counts();
         long double tmp = counts[0];
         for(ssize_t i = 1; i < ssize_t(counts.size()); ++i)
             tmp += static_cast<long double>(counts[i]) * (std::pow(wh_base_, -i));
@@ -1,9 +1,11 @@
-from _hll import _hll
+from _hll import _hll, jaccard_index, pairwise_jaccard, enable_stats, reset_stats, stats
 
 
 class hll(_hll):
     def addh(self, item):
-        ''' Hash an item and add it to the hll sketch. '''
+        ''' Hash an item and add it to the hll sketch.
+            To insert many items at once without holding the GIL, use addh_array for integer arrays
+            and add_strings for arrays or sequences of strings. '''
         if item.__hash__:
             self.add(item.__hash__())
         else:
@@ -16,4 +18,4 @@ class hll(_hll):
 
 
 __doc__ = "HyperLogLog module"
-__all__ = [hll]
+__all__ = ["hll", "jaccard_index", "pairwise_jaccard", "enable_stats", "reset_stats", "stats"]
@@ -0,0 +1,220 @@
+#ifndef HLL_MATRIX_H__
+#define HLL_MATRIX_H__
+#include "hll.h"
+
+namespace sketch {
+namespace hll {
+
+// Similarity measures available for all-pairs comparisons.
+// Symmetric measures are emitted as a condensed matrix: row i holds the comparisons of sketch i with sketches i + 1 to n - 1,
+// as in scipy.spatial.distance.squareform. Containment is asymmetric and is emitted as the full n x n matrix,
+// whose entry [i][j] is the fraction of sketch i's elements which are also in sketch j.
+enum PairwiseMeasure: uint8_t {
+    PAIRWISE_JACCARD_INDEX     = 0,
+    PAIRWISE_CONTAINMENT_INDEX = 1,
+    PAIRWISE_UNION_SIZE        = 2,
+    PAIRWISE_INTERSECTION_SIZE = 3
+};
+static constexpr bool is_symmetric(PairwiseMeasure measure) {return measure != PAIRWISE_CONTAINMENT_INDEX;}
+
+// Returns the number of entries in the output of an all-pairs comparison of n sketches.
+static constexpr size_t pairwise_size(size_t n, PairwiseMeasure measure) {
+    return is_symmetric(measure) ? n * (n - 1) / 2: n * n;
+}
+
+namespace detail {
+
+// Sketches are compared a tile of PAIRWISE_TILE x PAIRWISE_TILE pairs at a time, and registers are walked in chunks
+// of at most PAIRWISE_CHUNK bytes, so that each chunk of a sketch is loaded into cache once per tile rather than once per pair.
+static constexpr size_t PAIRWISE_TILE  = 8;
+static constexpr size_t PAIRWISE_CHUNK = 1 << 14;
+
+template<typename FloatType>
+struct pairwise_data_t {
+    const uint8_t *const *cores_;
+    const double          *cards_;
+    joint_histogram_t *scratch_; // PAIRWISE_TILE * PAIRWISE_TILE histograms per thread
+    FloatType               *out_;
+    size_t                     n_;
+    size_t            row_start_; // First row held by out_
+    size_t              row_end_;
+    uint32_t                  p_;
+    EstimationMethod      estim_;
+    JointEstimationMethod jestim_;
+    PairwiseMeasure      measure_;
+};
+
+// Offset of row i (relative to the first row in the buffer) in a condensed or full output buffer.
+static inline size_t pairwise_row_offset(size_t i, size_t n, PairwiseMeasure measure) {
+    return is_symmetric(measure) ? i * n - i * (i + 1) / 2: i * n;
+}
+
+template<typename FloatType>
+static inline FloatType pairwise_finalize(const joint_counts_t &jc, double ca, double cb, const pairwise_data_t<FloatType> &data) {
+    const uint32_t p = data.p_, q = 64 - p;
+    const uint64_t m = uint64_t(1) << p;
+    if(data.jestim_ == ERTL_JOINT_MLE) {
+        // Matches hllbase_t's jaccard_index, containment_index, union_size and ertl_joint.
+        const auto full_cmps = ertl_joint_estimate(jc.cu, jc.cg1, jc.cg2, jc.ceq, ca, cb, p, q);
+        switch(data.measure_) {
+            case PAIRWISE_JACCARD_INDEX:     return full_cmps[2] / (full_cmps[0] + full_cmps[1] + full_cmps[2]);
+            case PAIRWISE_CONTAINMENT_INDEX: return full_cmps[2] / (full_cmps[0] + full_cmps[2]);
+            case PAIRWISE_UNION_SIZE:        return full_cmps[0] + full_cmps[1] + full_cmps[2];
+            case PAIRWISE_INTERSECTION_SIZE: return full_cmps[2];
+            default: __builtin_unreachable();
+        }
+    }
+    const double us = calculate_estimate(jc.cu, data.estim_, m, p, make_alpha(m));
+    switch(data.measure_) {
+        case PAIRWISE_JACCARD_INDEX:     return std::max(0., (ca + cb - us) / us);
+        case PAIRWISE_CONTAINMENT_INDEX: return std::max(0., (ca + cb - us) / ca);
+        case PAIRWISE_UNION_SIZE:        return us;
+        case PAIRWISE_INTERSECTION_SIZE: return std::max(0., ca + cb - us);
+        default: __builtin_unreachable();
+    }
+}
+
+// Computes the rows in [rowtile * PAIRWISE_TILE, (rowtile + 1) * PAIRWISE_TILE) intersected with [row_start_, row_end_).
+template<typename FloatType>
+void pairwise_helper(void *data_, long rowtile, int tid) {
+    const pairwise_data_t<FloatType> &data(*reinterpret_cast<const pairwise_data_t<FloatType> *>(data_));
+    const size_t n = data.n_, m = size_t(1) << data.p_, chunk = std::min(m, PAIRWISE_CHUNK);
+    const size_t ibeg = data.row_start_ + rowtile * PAIRWISE_TILE, iend = std::min(ibeg + PAIRWISE_TILE, data.row_end_);
+    const bool symmetric = is_symmetric(data.measure_);
+    const size_t outbase = pairwise_row_offset(data.row_start_, n, data.measure_);
+    joint_histogram_t *const acc = data.scratch_ + size_t(tid) * PAIRWISE_TILE * PAIRWISE_TILE;
+    joint_counts_t jc;
+    for(size_t jbeg = symmetric ? ibeg: 0; jbeg < n; jbeg += PAIRWISE_TILE) {
+        const size_t jend = std::min(jbeg + PAIRWISE_TILE, n);
+        for(size_t k = 0; k < PAIRWISE_TILE * PAIRWISE_TILE; acc[k++].clear());
+        for(size_t off = 0; off < m; off += chunk) {
+            for(size_t i = ibeg; i < iend; ++i) {
+                for(size_t j = symmetric ? std::max(jbeg, i + 1): jbeg; j < jend; ++j) {
+                    if(j == i) continue;
+                    acc[(i - ibeg) * PAIRWISE_TILE + (j - jbeg)].add(data.cores_[i] + off, data.cores_[j] + off, chunk);
+                }
+            }
+        }
+        for(size_t i = ibeg; i < iend; ++i) {
+            FloatType *const row = data.out_ + pairwise_row_offset(i, n, data.measure_) - outbase;
+            for(size_t j = symmetric ? std::max(jbeg, i + 1): jbeg; j < jend; ++j) {
+                const size_t col = symmetric ? j - i - 1: j;
+                if(j == i) {
+                    row[col] = FloatType(1);
+                    continue;
+                }
+                std::memset(&jc, 0, sizeof(jc));
+                acc[(i - ibeg) * PAIRWISE_TILE + (j - jbeg)].finalize(jc.cu, jc.cg1, jc.cg2, jc.ceq);
+                row[col] = pairwise_finalize(jc, data.cards_[i], data.cards_[j], data);
+            }
+        }
+    }
+}
+
+template<typename HllType>
+struct pairwise_card_data_t {
+    const HllType *const *hlls_;
+    double               *cards_;
+};
+template<typename HllType>
+void pairwise_card_helper(void *data_, long i, int tid) {
+    const pairwise_card_data_t<HllType> &data(*reinterpret_cast<const pairwise_card_data_t<HllType> *>(data_));
+    const HllType &h = *data.hlls_[i];
+    // The estimates ertl_joint would use, computed once per sketch rather than once per pair.
+    data.cards_[i] = h.get_jestim() == ERTL_JOINT_MLE ? ertl_card(h): h.creport();
+}
+
+template<typename HllType, typename FloatType>
+class pairwise_engine_t {
+    const HllType *const               *hlls_;
+    size_t                                 n_;
+    std::vector<const uint8_t *>       cores_;
+    std::vector<double>                cards_;
+    PairwiseMeasure                  measure_;
+    int                             nthreads_;
+    // Each thread's tile of joint histograms, allocated once rather than once per tile.
+    mutable std::vector<joint_histogram_t> scratch_;
+public:
+    pairwise_engine_t(const HllType *const *hlls, size_t n, PairwiseMeasure measure, int nthreads):
+        hlls_(hlls), n_(n), cores_(n), cards_(n), measure_(measure),
+        nthreads_(nthreads > 0 ? nthreads: int(std::thread::hardware_concurrency())),
+        scratch_(size_t(nthreads_) * PAIRWISE_TILE * PAIRWISE_TILE)
+    {
+        for(size_t i = 0; i < n; ++i) {
+            if(hlls[i]->p() != hlls[0]->p())
+                throw std::runtime_error(std::string("All sketches must have the same p. Found ") + std::to_string(hlls[i]->p()) + " and " + std::to_string(hlls[0]->p()));
+            cores_[i] = hlls[i]->core().data();
+        }
+        if(n && hlls[0]->m() < sizeof(SIMDHolder))
+            throw std::runtime_error("Sketches are too small for all-pairs comparison.");
+        pairwise_card_data_t<HllType> data{hlls, cards_.data()};
+        kt_for(nthreads_, pairwise_card_helper<HllType>, &data, n);
+    }
+    // Fills out with the entries for rows [row_start, row_end). Not reentrant, since calls share the threads' scratch histograms.
+    void rows(FloatType *out, size_t row_start, size_t row_end) const {
+        if(row_end <= row_start) return;
+        pairwise_data_t<FloatType> data{cores_.data(), cards_.data(), scratch_.data(), out, n_, row_start, row_end,
+                                        hlls_[0]->p(), hlls_[0]->get_estim(), hlls_[0]->get_jestim(), measure_};
+        kt_for(nthreads_, pairwise_helper<FloatType>, &data, (row_end - row_start + PAIRWISE_TILE - 1) / PAIRWISE_TILE);
+    }
+    size_t row_size(size_t i) const {return is_symmetric(measure_) ? n_ - i - 1: n_;}
+};
+
+template<typename HllType>
+std::vector<const HllType *> pointers(const std::vector<HllType> &hlls) {
+    std::vector<const HllType *> ret(hlls.size());
+    for(size_t i = 0; i < hlls.size(); ++i) ret[i] = &hlls[i];
+    return ret;
+}
+
+} // namespace detail
+
+// Compares every pair of the n sketches pointed to by hlls, writing pairwise_size(n, measure) entries to out:
+// the condensed matrix for symmetric measures and the full matrix for containment.
+// Sketches must share p and estimation methods, and their estimates are computed once rather than once per pair.
+template<typename FloatType, typename HllType>
+void pairwise_matrix(const HllType *const *hlls, size_t n, FloatType *out, PairwiseMeasure measure=PAIRWISE_JACCARD_INDEX, int nthreads=-1) {
+    if(n < 2) return;
+    detail::pairwise_engine_t<HllType, FloatType> engine(hlls, n, measure, nthreads);
+    engine.rows(out, 0, n);
+}
+template<typename FloatType=float, typename HllType>
+std::vector<FloatType> pairwise_matrix(const std::vector<HllType> &hlls, PairwiseMeasure measure=PAIRWISE_JACCARD_INDEX, int nthreads=-1) {
+    std::vector<FloatType> ret(pairwise_size(hlls.size(), measure));
+    pairwise_matrix(detail::pointers(hlls).data(), hlls.size(), ret.data(), measure, nthreads);
+    return ret;
+}
+
+// Expands the condensed matrix of a symmetric measure over n sketches into the full n x n matrix, with diag on the diagonal.
+template<typename FloatType>
+void condensed_to_square(const FloatType *condensed, size_t n, FloatType *square, FloatType diag=FloatType(1)) {
+    for(size_t i = 0; i < n; ++i) {
+        square[i * n + i] = diag;
+        const FloatType *const row = condensed + i * n - i * (i + 1) / 2;
+        for(size_t j = i + 1; j < n; ++j) square[i * n + j] = square[j * n + i] = row[j - i - 1];
+    }
+}
+
+// As above, but writes the matrix to fp as binary FloatTypes in row-major order, computing at most rows_per_batch rows at a time.
+// This bounds memory use for collections whose matrices would not fit in memory.
+template<typename FloatType=float, typename HllType>
+void pairwise_matrix(const std::vector<HllType> &hlls, std::FILE *fp, PairwiseMeasure measure=PAIRWISE_JACCARD_INDEX, int nthreads=-1, size_t rows_per_batch=0) {
+    if(hlls.size() < 2) return;
+    const auto ptrs = detail::pointers(hlls);
+    detail::pairwise_engine_t<HllType, FloatType> engine(ptrs.data(), ptrs.size(), measure, nthreads);
+    const size_t n = hlls.size();
+    if(rows_per_batch == 0) rows_per_batch = std::max(size_t(detail::PAIRWISE_TILE) * std::thread::hardware_concurrency(), size_t(64));
+    std::vector<FloatType> buf;
+    for(size_t start = 0; start < n; start += rows_per_batch) {
+        const size_t end = std::min(start + rows_per_batch, n);
+        buf.resize(detail::pairwise_row_offset(end, n, measure) - detail::pairwise_row_offset(start, n, measure));
+        engine.rows(buf.data(), start, end);
+        if(std::fwrite(buf.data(), sizeof(FloatType), buf.size(), fp) != buf.size())
+            throw std::runtime_error("Error writing pairwise matrix to file.");
+    }
+}
+
+} // namespace hll
+} // namespace sketch
+
+#endif /* HLL_MATRIX_H__ */
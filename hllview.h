@@ -0,0 +1,142 @@
+#ifndef HLL_VIEW_H__
+#define HLL_VIEW_H__
+#include "packedhll.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace sketch {
+namespace hll {
+
+class hllview_t {
+// Read-only view over the registers of a sketch serialized by hllbase_t::write(int), i.e., uncompressed.
+// Files are memory-mapped, so opening one allocates nothing and only touches the pages that queries read.
+// Views can also wrap serialized sketches which are already in memory.
+// Registers follow a 28-byte header and are therefore not SIMD-aligned, so queries copy them a block
+// at a time into an aligned stack buffer, which keeps them in L1 while the dense kernels run over them.
+    static constexpr size_t HEADER_SIZE = 4 * sizeof(uint32_t) + sizeof(uint32_t) + sizeof(double);
+    const uint8_t                         *regs_;
+    void                                  *map_;
+    size_t                            map_size_;
+    mutable double                       value_;
+    uint32_t                                np_;
+    mutable uint8_t              is_calculated_;
+    EstimationMethod                     estim_;
+    JointEstimationMethod               jestim_;
+
+    void parse(const uint8_t *data, size_t len) {
+        if(len >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+            throw std::runtime_error("hllview_t requires an uncompressed sketch, written by write(int) or write(path, false).");
+        if(len < HEADER_SIZE) throw std::runtime_error("Serialized sketch is too short to contain a header.");
+        uint32_t bf[4];
+        std::memcpy(bf, data, sizeof(bf));
+        std::memcpy(&np_, data + sizeof(bf), sizeof(np_));
+        std::memcpy(&value_, data + sizeof(bf) + sizeof(np_), sizeof(value_));
+        if(bf[3] != 137) throw std::runtime_error("Serialized sketch was not written by hllbase_t::write(int).");
+        if(bf[1] > ERTL_MLE || bf[2] > ERTL_JOINT_MLE || np_ < 2 || np_ > 32)
+            throw std::runtime_error("Invalid header for serialized sketch.");
+        if(len != HEADER_SIZE + m())
+            throw std::runtime_error(std::string("Serialized sketch has ") + std::to_string(len - HEADER_SIZE) + " bytes of registers, expected " + std::to_string(m()));
+        is_calculated_ = bf[0];
+        estim_  = static_cast<EstimationMethod>(bf[1]);
+        jestim_ = static_cast<JointEstimationMethod>(bf[2]);
+        regs_ = data + HEADER_SIZE;
+    }
+public:
+    // Maps the sketch stored at path.
+    explicit hllview_t(const char *path): map_(nullptr), map_size_(0) {
+        const int fd = ::open(path, O_RDONLY);
+        if(fd < 0) throw std::runtime_error(std::string("Could not open file at ") + path);
+        struct stat st;
+        if(::fstat(fd, &st)) {
+            ::close(fd);
+            throw std::runtime_error(std::string("Could not stat file at ") + path);
+        }
+        map_size_ = st.st_size;
+        map_ = map_size_ ? ::mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0): MAP_FAILED;
+        ::close(fd);
+        if(map_ == MAP_FAILED) {
+            map_ = nullptr;
+            throw std::runtime_error(std::string("Could not map file at ") + path);
+        }
+        try {
+            parse(static_cast<const uint8_t *>(map_), map_size_);
+        } catch(...) {
+            ::munmap(map_, map_size_);
+            throw;
+        }
+    }
+    explicit hllview_t(const std::string &path): hllview_t(path.data()) {}
+    // Views a serialized sketch in memory, which must outlive the view.
+    hllview_t(const void *data, size_t len): map_(nullptr), map_size_(0) {
+        parse(static_cast<const uint8_t *>(data), len);
+    }
+    hllview_t(const hllview_t &) = delete;
+    hllview_t &operator=(const hllview_t &) = delete;
+    hllview_t(hllview_t &&o): regs_(o.regs_), map_(o.map_), map_size_(o.map_size_), value_(o.value_), np_(o.np_),
+        is_calculated_(o.is_calculated_), estim_(o.estim_), jestim_(o.jestim_)
+    {
+        o.map_ = nullptr;
+    }
+    ~hllview_t() {
+        if(map_) ::munmap(map_, map_size_);
+    }
+
+    uint64_t m() const {return static_cast<uint64_t>(1) << np_;}
+    uint32_t p() const {return np_;}
+    uint32_t q() const {return (sizeof(uint64_t) * CHAR_BIT) - np_;}
+    size_t size() const {return size_t(m());}
+    double alpha()          const {return make_alpha(m());}
+    double relative_error() const {return 1.03896 / std::sqrt(static_cast<double>(m()));}
+    const uint8_t *data() const {return regs_;}
+    uint8_t operator[](size_t index) const {return regs_[index];}
+    EstimationMethod get_estim()       const {return  estim_;}
+    JointEstimationMethod get_jestim() const {return jestim_;}
+    bool get_is_ready() const {return is_calculated_;}
+
+    void unpack_block(size_t offset, size_t n, uint8_t *buf) const {std::memcpy(buf, regs_ + offset, n);}
+    std::array<uint32_t, 64> sum_counts() const {return detail::block_sum_counts(*this);}
+    // Uses the estimate stored in the header when it was calculated before writing.
+    double creport() const {
+        if(!is_calculated_) {
+            value_ = detail::calculate_estimate(sum_counts(), estim_, m(), np_, alpha());
+            is_calculated_ = true;
+        }
+        return value_;
+    }
+    double report() const {return creport();}
+    double cardinality_estimate() const {return creport();}
+    void csum() const {creport();}
+
+    // Set operations, against views, dense, packed or hll4 sketches of the same size
+    template<typename OtherType>
+    double union_size(const OtherType &o) const {return detail::block_union_size(*this, o);}
+    template<typename OtherType>
+    std::array<double, 3> ertl_joint(const OtherType &o) const {return detail::block_ertl_joint(*this, o);}
+    template<typename OtherType>
+    double jaccard_index(const OtherType &o) const {
+        const auto full_cmps = ertl_joint(o);
+        return full_cmps[2] / (full_cmps[0] + full_cmps[1] + full_cmps[2]);
+    }
+    template<typename OtherType>
+    double containment_index(const OtherType &o) const {
+        const auto full_cmps = ertl_joint(o);
+        return full_cmps[2] / (full_cmps[0] + full_cmps[2]);
+    }
+    // Copies the registers into a dense sketch.
+    template<typename HashStruct=WangHash>
+    hllbase_t<HashStruct> to_hll() const {
+        hllbase_t<HashStruct> ret(np_, estim_, jestim_);
+        std::memcpy(ret.data(), regs_, m());
+        return ret;
+    }
+};
+
+inline std::array<double, 3> ertl_joint(const hllview_t &h1, const hllview_t &h2) {
+    return h1.ertl_joint(h2);
+}
+
+} // namespace hll
+} // namespace sketch
+
+#endif /* HLL_VIEW_H__ */
@@ -875,7 +875,7 @@ public:
 #define CASE_U(cse, func, msk)\
                 case cse: {\
                     const Space::Type mask = Space::set1(UINT64_C(msk));\
-                    for(const SIMDHolder *ptr = reinterpret_cast<const SIMDHolder *>(core_.get()), *eptr = reinterpret_cast<const SIMDHolder *>(core_.get() + core_.bytes());\
+                    for(const SIMDHolder *ptr = reinterpret_cast<const SIMDHolder *>(core_.get()), *eptr = reinterpret_cast<const SIMDHolder *>(reinterpret_cast<const uint8_t *>(core_.get()) + core_.bytes());\
                         ptr != eptr; ++ptr) {\
                         auto tmp = *ptr;\
                         tmp = Space::and_fn(Space::srli(*reinterpret_cast<VType *>(&tmp), r_), mask);\
@@ -958,7 +958,7 @@ public:
         if(core_.bytes() >= sizeof(SIMDHolder)) {
             const SIMDHolder *optr = reinterpret_cast<const SIMDHolder *>(o.core_.get());
             SIMDHolder *ptr = reinterpret_cast<SIMDHolder *>(core_.get()),
-                       *eptr = reinterpret_cast<SIMDHolder *>(core_.get() + core_.bytes());
+                       *eptr = reinterpret_cast<SIMDHolder *>(reinterpret_cast<uint8_t *>(core_.get()) + core_.bytes());
             switch(simd_policy()) {
 #define CASE_U(cse, op)\
                 case cse:\
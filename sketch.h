@@ -12,6 +12,8 @@
 #include "filterhll.h"
 #include "mult.h"
 #include "sparse.h"
+#include "slidinghll.h"
+#include "strhash.h"
 
 namespace sketch {
     // Flatten all classes to global sketch namespace.
@@ -0,0 +1,231 @@
+#ifndef SLIDING_HLL_H__
+#define SLIDING_HLL_H__
+#include "hll.h"
+
+namespace sketch {
+namespace hll {
+
+template<typename HashStruct=WangHash>
+class slidinghllbase_t {
+// Sliding-window HyperLogLog (Chabchoub and Hebrail, 2010).
+// Instead of a register's maximum rank, the sketch keeps the latest timestamp at which each (register, rank) pair was seen,
+// so the registers of the sketch over any window ending at a given time can be recovered:
+// a register's value is the largest rank whose timestamp falls within the window.
+// Keeping one timestamp per pair, rather than the list of future possible maxima, bounds memory.
+// Ranks above MAX_RANK are stored as MAX_RANK, which only matters once a window holds about m * 2**MAX_RANK distinct elements,
+// and stamps are 32-bit offsets from a base time, so the sketch takes m * MAX_RANK * 4 bytes: 128 bytes per register, or 2 MiB at p = 14.
+// Timestamps are arbitrary unsigned integers (e.g., seconds or milliseconds since an epoch), and windows are in the same units.
+// A window of length w ending at `now` contains timestamps t with t > now - w. Since only the latest stamp of each pair is kept,
+// queries should end at or after the latest insertion, which is the default.
+// When an insertion's offset would not fit in 32 bits, the base advances to the start of the maximum window ending at it,
+// discarding older stamps; insertions older than the base are ignored. Advancing the base rewrites every stamp,
+// so it must not run concurrently with other insertions. It happens at most once every 2**32 - max_window time units,
+// and expire() advances the base as well.
+// Stamps are laid out rank-major, so reconstructing the registers for a window is a linear pass over each rank's stamps.
+public:
+    static constexpr uint32_t MAX_RANK = 32;
+private:
+    std::vector<uint32_t, Allocator<uint32_t>> stamps_; // Stamps are stored as t - base_ + 1, so that 0 marks an empty slot.
+    uint64_t                               max_window_;
+    uint64_t                                   latest_;
+    uint64_t                                     base_;
+    uint32_t                                       np_;
+    EstimationMethod                            estim_;
+    JointEstimationMethod                      jestim_;
+    HashStruct                                     hf_;
+
+    template<typename T>
+    static INLINE void update(T *ptr, T val) {
+#ifndef NOT_THREADSAFE
+        for(T cur; (cur = *ptr) < val; __sync_bool_compare_and_swap(ptr, cur, val));
+#else
+        *ptr = std::max(*ptr, val);
+#endif
+    }
+    uint32_t *slot(uint32_t index, uint32_t rank) {return stamps_.data() + ((rank < MAX_RANK ? rank: MAX_RANK) - 1) * m() + index;}
+    // Converts a stamp relative to base into one relative to base_ (>= base), or 0 if it precedes base_.
+    uint32_t rebased(uint32_t s, uint64_t base) const {
+        return s && s + base > base_ ? uint32_t(s + base - base_): uint32_t(0);
+    }
+    // Moves the base forward to new_base, clearing stamps older than it.
+    void advance_base(uint64_t new_base) {
+        if(new_base <= base_) return;
+        const uint64_t old_base = base_;
+        base_ = new_base;
+        for(auto &s: stamps_) s = rebased(s, old_base);
+    }
+    // Records that hashval was seen at time t.
+    void insert(uint32_t index, uint32_t rank, uint64_t t) {
+        if(t < base_) return;
+        if(t - base_ >= std::numeric_limits<uint32_t>::max()) advance_base(t + 1 - max_window_);
+        update(slot(index, rank), uint32_t(t - base_ + 1));
+    }
+    void check_window(uint64_t window) const {
+        if(window > max_window_)
+            throw std::runtime_error(std::string("Window ") + std::to_string(window) + " exceeds the maximum window of " + std::to_string(max_window_));
+    }
+    template<typename Func>
+    void hash_blocks(const uint64_t *vals, size_t n, const Func &func) const {
+        uint64_t buf[detail::BATCH_SIZE];
+        for(size_t i = 0; i < n; i += detail::BATCH_SIZE) {
+            const size_t nb = std::min(n - i, detail::BATCH_SIZE);
+            hash::hash_batch(hf_, vals + i, buf, nb);
+            func(static_cast<const uint64_t *>(buf), nb, i);
+        }
+    }
+    // Inserts n hashes, the ith of which was seen at stamps(i).
+    template<typename StampFunc>
+    void add_batch_impl(const uint64_t *hashes, size_t n, const StampFunc &stamps) {
+        uint32_t indices[detail::BATCH_SIZE];
+        uint8_t  ranks[detail::BATCH_SIZE];
+        uint64_t latest = 0;
+        for(size_t i = 0; i < n; i += detail::BATCH_SIZE) {
+            const size_t nb = std::min(n - i, detail::BATCH_SIZE);
+            detail::hashes2regs(hashes + i, indices, ranks, nb, np_);
+            for(size_t j = 0; j < nb; ++j) __builtin_prefetch(slot(indices[j], ranks[j]), 1);
+            for(size_t j = 0; j < nb; ++j) {
+                const uint64_t t = stamps(i + j);
+                insert(indices[j], ranks[j], t);
+                latest = std::max(latest, t);
+            }
+        }
+        update(&latest_, latest);
+    }
+public:
+    template<typename... Args>
+    slidinghllbase_t(unsigned np, uint64_t max_window, EstimationMethod estim=ERTL_MLE,
+                     JointEstimationMethod jestim=ERTL_JOINT_MLE, Args &&... args):
+        stamps_((size_t(1) << np) * MAX_RANK), max_window_(max_window), latest_(0), base_(0), np_(np),
+        estim_(estim), jestim_(jestim), hf_(std::forward<Args>(args)...)
+    {
+        if(np < 4 || np > 26) throw std::runtime_error(std::string("slidinghllbase_t requires 4 <= p <= 26. Provided: ") + std::to_string(np));
+        if(max_window == 0 || max_window > (uint64_t(1) << 31))
+            throw std::runtime_error(std::string("slidinghllbase_t requires 0 < max_window <= 2**31. Provided: ") + std::to_string(max_window));
+    }
+    explicit slidinghllbase_t(const char *path): max_window_(0), latest_(0), base_(0), np_(0) {read(path);}
+
+    uint64_t m() const {return uint64_t(1) << np_;}
+    uint32_t p() const {return np_;}
+    uint32_t q() const {return (sizeof(uint64_t) * CHAR_BIT) - np_;}
+    uint32_t nranks() const {return MAX_RANK;}
+    uint64_t max_window() const {return max_window_;}
+    // Latest timestamp inserted, which is the default end of query windows.
+    uint64_t latest() const {return latest_;}
+    size_t memory_usage() const {return stamps_.size() * sizeof(stamps_[0]) + sizeof(*this);}
+    EstimationMethod get_estim()       const {return  estim_;}
+    JointEstimationMethod get_jestim() const {return jestim_;}
+
+    void add(uint64_t hashval, uint64_t t) {
+        const uint32_t index = hashval >> q(), lzt = clz(((hashval << 1)|1) << (np_ - 1)) + 1;
+        insert(index, lzt, t);
+        update(&latest_, t);
+    }
+    void addh(uint64_t element, uint64_t t) {add(hf_(element), t);}
+    // Bulk insertion of hashes seen at times stamps[0..n), or all at time t.
+    void add_batch(const uint64_t *hashes, const uint64_t *stamps, size_t n) {
+        add_batch_impl(hashes, n, [stamps](size_t i) {return stamps[i];});
+    }
+    void add_batch(const uint64_t *hashes, size_t n, uint64_t t) {
+        add_batch_impl(hashes, n, [t](size_t) {return t;});
+    }
+    void addh_batch(const uint64_t *vals, const uint64_t *stamps, size_t n) {
+        hash_blocks(vals, n, [this,stamps](const uint64_t *hashes, size_t nb, size_t off) {add_batch(hashes, stamps + off, nb);});
+    }
+    void addh_batch(const uint64_t *vals, size_t n, uint64_t t) {
+        hash_blocks(vals, n, [this,t](const uint64_t *hashes, size_t nb, size_t) {add_batch(hashes, nb, t);});
+    }
+
+    // Fills regs (of size m()) with the registers of the sketch over the window of length window ending at now.
+    void window_registers(uint8_t *regs, uint64_t window, uint64_t now) const {
+        check_window(window);
+        // In stored units, a stamp s is in the window if s > now + 1 - window - base_.
+        const uint64_t threshold = now + 1 >= window + base_ ? now + 1 - window - base_: 0;
+        std::memset(regs, 0, m());
+        for(uint32_t r = 1; r <= nranks(); ++r) {
+            const uint32_t *const s = stamps_.data() + (r - 1) * m();
+            for(size_t i = 0; i < m(); ++i) regs[i] = s[i] > threshold ? uint8_t(r): regs[i];
+        }
+    }
+    std::array<uint32_t, 64> sum_counts(uint64_t window, uint64_t now) const {
+        std::vector<uint8_t, Allocator<uint8_t>> regs(m());
+        window_registers(regs.data(), window, now);
+        detail::byte_histogram_t<64> hist;
+        hist.add(regs.data(), regs.size());
+        return hist.counts();
+    }
+    // Estimated number of distinct elements seen in the window of length window ending at now (by default, the latest timestamp).
+    double cardinality_estimate(uint64_t window, uint64_t now) const {
+        return detail::calculate_estimate(sum_counts(window, now), estim_, m(), np_, make_alpha(m()));
+    }
+    double cardinality_estimate(uint64_t window) const {return cardinality_estimate(window, latest_);}
+    double report(uint64_t window) const {return cardinality_estimate(window);}
+    // Estimates for several windows ending at now.
+    std::vector<double> cardinality_estimates(const uint64_t *windows, size_t n, uint64_t now) const {
+        std::vector<double> ret(n);
+        for(size_t i = 0; i < n; ++i) ret[i] = cardinality_estimate(windows[i], now);
+        return ret;
+    }
+    // A standalone sketch over the window, for comparisons against other sketches.
+    hllbase_t<HashStruct> window_hll(uint64_t window, uint64_t now) const {
+        hllbase_t<HashStruct> ret(np_, estim_, jestim_);
+        window_registers(ret.data(), window, now);
+        return ret;
+    }
+    hllbase_t<HashStruct> window_hll(uint64_t window) const {return window_hll(window, latest_);}
+
+    // Clears stamps which have fallen out of every window ending at or after now, advancing the base to the oldest time still needed.
+    void expire(uint64_t now) {
+        if(now + 1 >= max_window_) advance_base(now + 1 - max_window_);
+    }
+    void clear() {
+        std::fill(stamps_.begin(), stamps_.end(), uint32_t(0));
+        latest_ = base_ = 0;
+    }
+    // Merges a sketch of another stream. Windows of the result are limited to the smaller of the two maxima.
+    slidinghllbase_t &operator+=(const slidinghllbase_t &other) {
+        if(other.np_ != np_) throw std::runtime_error(std::string("For operator +=: p (") + std::to_string(np_) + ") != other.p (" + std::to_string(other.np_) + ")");
+        advance_base(other.base_);
+        for(size_t i = 0; i < stamps_.size(); ++i) stamps_[i] = std::max(stamps_[i], rebased(other.stamps_[i], other.base_));
+        latest_ = std::max(latest_, other.latest_);
+        max_window_ = std::min(max_window_, other.max_window_);
+        return *this;
+    }
+    slidinghllbase_t operator+(const slidinghllbase_t &other) const {
+        slidinghllbase_t ret(*this);
+        ret += other;
+        return ret;
+    }
+
+    void write(gzFile fp) const {
+        using common::io::gzwrite_all;
+        const uint32_t bf[]{np_, estim_, jestim_, 0};
+        gzwrite_all(fp, bf, sizeof(bf));
+        gzwrite_all(fp, &max_window_, sizeof(max_window_));
+        gzwrite_all(fp, &latest_, sizeof(latest_));
+        gzwrite_all(fp, &base_, sizeof(base_));
+        gzwrite_all(fp, stamps_.data(), stamps_.size() * sizeof(stamps_[0]));
+    }
+    void write(const char *path) const {common::io::write_path(*this, path);}
+    void read(gzFile fp) {
+        using common::io::gzread_all;
+        uint32_t bf[4];
+        gzread_all(fp, bf, sizeof(bf));
+        if(bf[0] < 4 || bf[0] > 26 || bf[1] > ERTL_MLE || bf[2] > ERTL_JOINT_MLE)
+            throw std::runtime_error("Invalid header for serialized slidinghllbase_t.");
+        np_ = bf[0];
+        estim_  = static_cast<EstimationMethod>(bf[1]);
+        jestim_ = static_cast<JointEstimationMethod>(bf[2]);
+        gzread_all(fp, &max_window_, sizeof(max_window_));
+        gzread_all(fp, &latest_, sizeof(latest_));
+        gzread_all(fp, &base_, sizeof(base_));
+        stamps_.resize(m() * nranks());
+        gzread_all(fp, stamps_.data(), stamps_.size() * sizeof(stamps_[0]));
+    }
+    void read(const char *path) {common::io::read_path(*this, path);}
+};
+using slidinghll_t = slidinghllbase_t<>;
+
+} // namespace hll
+} // namespace sketch
+
+#endif /* SLIDING_HLL_H__ */
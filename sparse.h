@@ -27,6 +27,253 @@ struct SparseHLL32: public SparseEncoding {
     }
 };
 
+// Joint register histograms (see hll::detail::ertl_joint_estimate) of two sketches given as SparseHLL32 words,
+// sorted by index with one word per register, computed by a linear merge without touching the 2^p registers.
+template<typename It1, typename It2>
+inline hll::detail::joint_counts_t joint_counts(It1 a, It1 aend, It2 b, It2 bend, unsigned p) {
+    hll::detail::joint_counts_t ret{};
+    uint64_t n = 0;
+    for(; a != aend && b != bend; ++n) {
+        const uint32_t ia = SparseHLL32::get_index(*a), ib = SparseHLL32::get_index(*b);
+        if(ia < ib) ++ret.cg1[SparseHLL32::get_value(*a++)];
+        else if(ib < ia) ++ret.cg2[SparseHLL32::get_value(*b++)];
+        else {
+            const uint8_t va = SparseHLL32::get_value(*a++), vb = SparseHLL32::get_value(*b++);
+            if(va > vb)      ++ret.cg1[va];
+            else if(vb > va) ++ret.cg2[vb];
+            else             ++ret.ceq[va];
+        }
+    }
+    for(; a != aend; ++n) ++ret.cg1[SparseHLL32::get_value(*a++)];
+    for(; b != bend; ++n) ++ret.cg2[SparseHLL32::get_value(*b++)];
+    ret.ceq[0] += (uint64_t(1) << p) - n;
+    for(size_t i = 0; i < 64; ++i) ret.cu[i] = ret.cg1[i] + ret.cg2[i] + ret.ceq[i];
+    return ret;
+}
+// As above, but against dense registers, whose histogram is passed in or computed.
+template<typename It, typename HashStruct>
+inline hll::detail::joint_counts_t joint_counts(It a, It aend, const hll::hllbase_t<HashStruct> &h, const std::array<uint32_t, 64> *hsum=nullptr) {
+    hll::detail::joint_counts_t ret{};
+    ret.cg2 = hsum ? *hsum: hll::detail::sum_counts(h.core());
+    ret.ceq[0] = ret.cg2[0];
+    ret.cg2[0] = 0;
+    const uint8_t *const regs = h.data();
+    for(; a != aend; ++a) {
+        const uint8_t va = SparseHLL32::get_value(*a), vb = regs[SparseHLL32::get_index(*a)];
+        if(vb) --ret.cg2[vb];
+        else   --ret.ceq[0];
+        if(va > vb)      ++ret.cg1[va];
+        else if(vb > va) ++ret.cg2[vb];
+        else             ++ret.ceq[va];
+    }
+    for(size_t i = 0; i < 64; ++i) ret.cu[i] = ret.cg1[i] + ret.cg2[i] + ret.ceq[i];
+    return ret;
+}
+
+// Compressed format for sorted SparseHLL32 words:
+//   uint32_t header[4]: SPARSE_MAGIC, p, number of words n, bytes of delta data
+//   (n + 3) / 4 control bytes, one per group of 4 index deltas, with 2 bits per delta giving its length in bytes minus one
+//   Delta data: index gaps (the first index is stored as is), little-endian, in 1 to 4 bytes each (stream-vbyte)
+//   3 * ((n + 3) / 4) bytes of 6-bit values, 4 per 3 bytes
+// The final group is padded with zero-valued, one-byte deltas.
+// Control and data bytes are kept apart so that a group's deltas are decoded with one shuffle, whose mask is looked up by its control byte.
+static constexpr uint32_t SPARSE_MAGIC = 0x31485053u; // "SPH1"
+static constexpr size_t SPARSE_HEADER_SIZE = 4 * sizeof(uint32_t);
+
+namespace detail {
+struct svb_tables_t {
+    uint8_t shuffle[256][16];
+    uint8_t length[256];
+    constexpr svb_tables_t(): shuffle{}, length{} {
+        for(unsigned c = 0; c < 256; ++c) {
+            unsigned offset = 0;
+            for(unsigned i = 0; i < 4; ++i) {
+                const unsigned len = ((c >> (2 * i)) & 3) + 1;
+                for(unsigned j = 0; j < 4; ++j)
+                    shuffle[c][4 * i + j] = j < len ? offset + j: 0xFF;
+                offset += len;
+            }
+            length[c] = offset;
+        }
+    }
+};
+static constexpr svb_tables_t SVB_TABLES{};
+
+static inline unsigned svb_length(uint32_t v) {return v < (1u << 8) ? 1: v < (1u << 16) ? 2: v < (1u << 24) ? 3: 4;}
+} // namespace detail
+
+// Appends the compressed encoding of n sorted words to out.
+inline void encode_words(const uint32_t *words, size_t n, unsigned p, std::vector<uint8_t> &out) {
+    const size_t ngroups = (n + 3) / 4, start = out.size();
+    out.resize(start + SPARSE_HEADER_SIZE + ngroups);
+    uint32_t prev = 0;
+    for(size_t g = 0; g < ngroups; ++g) {
+        uint8_t ctrl = 0;
+        for(size_t i = 0; i < 4; ++i) {
+            uint32_t delta = 0;
+            if(4 * g + i < n) {
+                const uint32_t index = SparseHLL32::get_index(words[4 * g + i]);
+                delta = index - prev;
+                prev = index;
+            }
+            const unsigned len = detail::svb_length(delta);
+            ctrl |= (len - 1) << (2 * i);
+            for(unsigned j = 0; j < len; ++j) out.push_back(delta >> (8 * j));
+        }
+        out[start + SPARSE_HEADER_SIZE + g] = ctrl;
+    }
+    const uint32_t header[4]{SPARSE_MAGIC, p, uint32_t(n), uint32_t(out.size() - start - SPARSE_HEADER_SIZE - ngroups)};
+    std::memcpy(&out[start], header, sizeof(header));
+    for(size_t g = 0; g < ngroups; ++g) {
+        uint32_t packed = 0;
+        for(size_t i = 0; i < 4 && 4 * g + i < n; ++i)
+            packed |= uint32_t(SparseHLL32::get_value(words[4 * g + i])) << (6 * i);
+        out.push_back(packed); out.push_back(packed >> 8); out.push_back(packed >> 16);
+    }
+}
+
+// Size of the encoding whose header is at data, for reading it from a stream.
+inline size_t serialized_size_from_header(const uint8_t *data) {
+    uint32_t header[4];
+    std::memcpy(header, data, sizeof(header));
+    if(header[0] != SPARSE_MAGIC) throw std::runtime_error("Data is not a compressed sparse sketch.");
+    return SPARSE_HEADER_SIZE + 4 * ((size_t(header[2]) + 3) / 4) + header[3];
+}
+
+// Read-only view over compressed words, which must outlive it.
+// Its iterators decode words a group at a time as they advance, so views can be merged or queried
+// (e.g., with joint_counts) without first being decoded into a vector.
+class sparse_view_t {
+    const uint8_t *ctrl_, *data_, *vals_;
+    size_t n_, ndata_;
+    unsigned p_;
+public:
+    class const_iterator {
+        const uint8_t *ctrl_, *data_, *dend_, *vals_;
+        size_t i_, n_;
+        uint32_t prev_, buf_[4];
+        void decode_group() {
+            const uint8_t ctrl = ctrl_[i_ / 4];
+            const size_t len = detail::SVB_TABLES.length[ctrl];
+#if __SSSE3__
+            if(data_ + sizeof(__m128i) <= dend_) {
+                __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data_)),
+                                             _mm_loadu_si128(reinterpret_cast<const __m128i *>(detail::SVB_TABLES.shuffle[ctrl])));
+                v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+                v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(buf_), _mm_add_epi32(v, _mm_set1_epi32(prev_)));
+                prev_ = buf_[3];
+                data_ += len;
+                return;
+            }
+#endif
+            for(unsigned i = 0; i < 4; ++i) {
+                const unsigned dlen = ((ctrl >> (2 * i)) & 3) + 1;
+                uint32_t delta = 0;
+                for(unsigned j = 0; j < dlen; ++j) delta |= uint32_t(*data_++) << (8 * j);
+                buf_[i] = prev_ += delta;
+            }
+        }
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = uint32_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const uint32_t *;
+        using reference = uint32_t;
+        const_iterator(const sparse_view_t &v, size_t i): ctrl_(v.ctrl_), data_(v.data_), dend_(v.data_ + v.ndata_), vals_(v.vals_), i_(i), n_(v.n_), prev_(0) {
+            if(i_ < v.n_) decode_group();
+        }
+        uint32_t index() const {return buf_[i_ & 3];}
+        uint8_t value() const {
+            const uint8_t *const p = vals_ + 3 * (i_ / 4);
+            return ((p[0] | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16)) >> (6 * (i_ & 3))) & SparseHLL32::MASK;
+        }
+        uint32_t operator*() const {return SparseHLL32::encode_value(index(), value());}
+        const_iterator &operator++() {
+            if((++i_ & 3) == 0 && i_ < n_) decode_group();
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator ret(*this);
+            ++*this;
+            return ret;
+        }
+        bool operator==(const const_iterator &o) const {return i_ == o.i_;}
+        bool operator!=(const const_iterator &o) const {return i_ != o.i_;}
+    };
+    // Parses compressed words at data, throwing if len does not match their header or their control bytes.
+    sparse_view_t(const uint8_t *data, size_t len) {
+        if(len < SPARSE_HEADER_SIZE) throw std::runtime_error("Compressed sparse sketch is too short to contain a header.");
+        uint32_t header[4];
+        std::memcpy(header, data, sizeof(header));
+        if(header[0] != SPARSE_MAGIC) throw std::runtime_error("Data is not a compressed sparse sketch.");
+        p_ = header[1]; n_ = header[2]; ndata_ = header[3];
+        if(p_ > SparseHLL32::max_p() || n_ > (size_t(1) << p_)) throw std::runtime_error("Invalid header for compressed sparse sketch.");
+        const size_t ngroups = (n_ + 3) / 4;
+        if(len != serialized_size()) throw std::runtime_error(std::string("Compressed sparse sketch has ") + std::to_string(len) + " bytes, expected " + std::to_string(serialized_size()));
+        ctrl_ = data + SPARSE_HEADER_SIZE;
+        data_ = ctrl_ + ngroups;
+        vals_ = data_ + ndata_;
+        // The decoders trust the control bytes, so check that they describe exactly the delta data present.
+        size_t nbytes = 0;
+        for(size_t g = 0; g < ngroups; nbytes += detail::SVB_TABLES.length[ctrl_[g++]]);
+        if(nbytes != ndata_) throw std::runtime_error(std::string("Compressed sparse sketch's control bytes describe ") + std::to_string(nbytes) + " bytes of deltas, but it has " + std::to_string(ndata_));
+        // Indices are used to address dense registers and merged in order, so they must be strictly increasing and below 2**p.
+        const uint8_t *dp = data_;
+        uint64_t index = 0;
+        for(size_t i = 0; i < n_; ++i) {
+            const unsigned dlen = ((ctrl_[i / 4] >> (2 * (i & 3))) & 3) + 1;
+            uint32_t delta = 0;
+            for(unsigned j = 0; j < dlen; ++j) delta |= uint32_t(*dp++) << (8 * j);
+            if(i && delta == 0) throw std::runtime_error("Compressed sparse sketch's indices are not strictly increasing.");
+            if((index += delta) >= (uint64_t(1) << p_))
+                throw std::runtime_error(std::string("Compressed sparse sketch has index ") + std::to_string(index) + " >= 2**" + std::to_string(p_));
+        }
+    }
+    sparse_view_t(const std::vector<uint8_t> &buf): sparse_view_t(buf.data(), buf.size()) {}
+    // Size of the full encoding, including the header.
+    size_t serialized_size() const {return SPARSE_HEADER_SIZE + 4 * ((n_ + 3) / 4) + ndata_;}
+    const_iterator begin() const {return const_iterator(*this, 0);}
+    const_iterator end()   const {return const_iterator(*this, n_);}
+    size_t size() const {return n_;}
+    unsigned p() const {return p_;}
+    unsigned q() const {return 64 - p_;}
+    // Register histogram, which only needs the values.
+    std::array<uint32_t, 64> sum() const {
+        std::array<uint32_t, 64> ret{0};
+        for(size_t g = 0; g < (n_ + 3) / 4; ++g) {
+            const uint32_t packed = vals_[3 * g] | (uint32_t(vals_[3 * g + 1]) << 8) | (uint32_t(vals_[3 * g + 2]) << 16);
+            for(size_t i = 0; i < 4 && 4 * g + i < n_; ++i) ++ret[(packed >> (6 * i)) & SparseHLL32::MASK];
+        }
+        ret[0] = (uint64_t(1) << p_) - n_;
+        return ret;
+    }
+    double report() const {return hll::detail::ertl_ml_estimate(sum(), p_, q());}
+    // Comparisons against other views or SparseHLLs.
+    template<typename OtherType>
+    std::array<double, 3> query(const OtherType &o) const {return sparse_query(*this, o);}
+    template<typename OtherType>
+    double jaccard_index(const OtherType &o) const {
+        auto lq = query(o);
+        return lq[2] / (lq[0] + lq[1] + lq[2]);
+    }
+    template<typename OtherType>
+    double containment_index(const OtherType &o) const {
+        auto lq = query(o);
+        return lq[2] / (lq[0] + lq[2]);
+    }
+};
+
+// Comparisons of sparse sketches or compressed views, by merging their words, as SparseHLL::query does.
+template<typename S1, typename S2>
+inline std::array<double, 3> sparse_query(const S1 &a, const S2 &b) {
+    if(a.p() != b.p()) throw std::runtime_error(std::string("p (") + std::to_string(a.p()) + ") != other.p (" + std::to_string(b.p()) + ")");
+    const auto usum = joint_counts(a.begin(), a.end(), b.begin(), b.end(), a.p()).cu;
+    const double myrep = a.report(), orep = b.report(), us = hll::detail::ertl_ml_estimate(usum, a.p(), a.q()),
+                 is = myrep + orep - us;
+    return std::array<double, 3>{std::max(myrep - is, 0.), std::max(orep - is, 0.), std::max(is, 0.)};
+}
+
 template<typename HashStruct=hash::WangHash>
 class SparseHLL {
     int p_;
@@ -169,6 +416,80 @@ public:
         auto lq = query(hll, a);
         return lq[2] / (lq[0] + lq[2]);
     }
+    // Comparisons against another sparse sketch or a compressed view, by merging the two sorted word lists.
+    std::array<double, 3> query(const SparseHLL &o) const {
+        assert(is_sorted() && o.is_sorted());
+        return sparse_query(*this, o);
+    }
+    std::array<double, 3> query(const sparse_view_t &o) const {
+        assert(is_sorted());
+        return sparse_query(*this, o);
+    }
+    double union_size(const SparseHLL &o) const {
+        auto lq = query(o);
+        return lq[0] + lq[1] + lq[2];
+    }
+    double jaccard_index(const SparseHLL &o) const {
+        auto lq = query(o);
+        return lq[2] / (lq[0] + lq[1] + lq[2]);
+    }
+    double jaccard_index(const sparse_view_t &o) const {
+        auto lq = query(o);
+        return lq[2] / (lq[0] + lq[1] + lq[2]);
+    }
+    double containment_index(const SparseHLL &o) const {
+        auto lq = query(o);
+        return lq[2] / (lq[0] + lq[2]);
+    }
+    double containment_index(const sparse_view_t &o) const {
+        auto lq = query(o);
+        return lq[2] / (lq[0] + lq[2]);
+    }
+
+    // Serialization in the compressed format described at encode_words.
+    std::vector<uint8_t> serialize() const {
+        std::vector<uint8_t> ret;
+        if(is_sorted()) encode_words(vals_.data(), vals_.size(), p_, ret);
+        else {
+            SparseHLL tmp(*this);
+            tmp.sort();
+            encode_words(tmp.vals_.data(), tmp.vals_.size(), p_, ret);
+        }
+        return ret;
+    }
+    void write(gzFile fp) const {
+        const auto buf = serialize();
+        common::io::gzwrite_all(fp, buf.data(), buf.size());
+    }
+    void write(int fileno) const {
+        const auto buf = serialize();
+        common::io::write_all(fileno, buf.data(), buf.size());
+    }
+    void write(const char *path, bool write_gz=false) const {common::io::write_path(*this, path, write_gz);}
+    void write(const std::string &path, bool write_gz=false) const {write(path.data(), write_gz);}
+    // Replaces the contents with the decoded view.
+    void assign(const sparse_view_t &view) {
+        p_ = view.p();
+        v_ = -1.;
+        sum_.reset();
+        vals_.assign(view.begin(), view.end());
+    }
+    void read(gzFile fp) {
+        std::vector<uint8_t> buf(SPARSE_HEADER_SIZE);
+        common::io::gzread_all(fp, buf.data(), buf.size());
+        buf.resize(serialized_size_from_header(buf.data()));
+        const size_t rest = buf.size() - SPARSE_HEADER_SIZE;
+        common::io::gzread_all(fp, buf.data() + SPARSE_HEADER_SIZE, rest);
+        assign(sparse_view_t(buf));
+    }
+    void read(const char *path) {common::io::read_path(*this, path);}
+    void read(const std::string &path) {read(path.data());}
+    explicit SparseHLL(const sparse_view_t &view): p_(view.p()) {assign(view);}
+    explicit SparseHLL(const char *path): p_(0) {read(path);}
+    unsigned p() const {return p_;}
+    size_t size() const {return vals_.size();}
+    auto begin() const {return vals_.cbegin();}
+    auto end()   const {return vals_.cend();}
     template<typename Allocator>
     SparseHLL(const std::vector<uint32_t, Allocator> &a) {
         assert(vals_.size() == 0);
@@ -215,6 +536,238 @@ public:
     }
 };
 
+// HLL which starts out as a sorted list of SparseHLL32 words, one per nonzero register, and promotes itself to a dense
+// hllbase_t once the sparse representation would use as much memory as the dense one.
+// Inserts are appended to an unsorted buffer, which is sorted and merged into the list when it fills or the sketch is queried.
+// The buffer grows with the list, so that merges cost amortized O(log n) per insert.
+// Estimates are identical to those of an hllbase_t with the same parameters and elements.
+// Not threadsafe, even for const use: queries such as report() and ertl_joint() merge the buffer into the list,
+// so concurrent readers of one sketch must be serialized by the caller.
+template<typename HashStruct=hash::WangHash>
+class HybridHLL {
+    static constexpr size_t MIN_BUFFER_SIZE = 16;
+    mutable std::vector<uint32_t>                     vals_; // Sorted, with one word per register
+    mutable std::vector<uint32_t>                   buffer_; // Unsorted, possibly with repeated registers
+    std::unique_ptr<hll::hllbase_t<HashStruct>>      dense_;
+    size_t                                      max_sparse_;
+    uint32_t                                            np_;
+    hll::EstimationMethod                            estim_;
+    hll::JointEstimationMethod                      jestim_;
+    HashStruct                                          hf_;
+
+    // Sorts words and keeps the largest value for each register, in place.
+    static void flatten_words(std::vector<uint32_t> &a) {
+        if(a.size() > 64) common::sort::default_sort(a.begin(), a.end());
+        else              common::sort::insertion_sort(a.begin(), a.end());
+        size_t nfilled = 0;
+        for(size_t i = 0; i < a.size(); ++i)
+            if(i + 1 == a.size() || SparseHLL32::get_index(a[i]) != SparseHLL32::get_index(a[i + 1]))
+                a[nfilled++] = a[i];
+        a.resize(nfilled);
+    }
+    // Merges sorted, flattened words from [beg, end) into vals_.
+    void merge_words(const uint32_t *beg, const uint32_t *end) const {
+        std::vector<uint32_t> tmp;
+        tmp.reserve(vals_.size() + (end - beg));
+        auto it = vals_.cbegin();
+        while(it != vals_.cend() && beg != end) {
+            const uint32_t i1 = SparseHLL32::get_index(*it), i2 = SparseHLL32::get_index(*beg);
+            if(i1 < i2)      tmp.push_back(*it++);
+            else if(i2 < i1) tmp.push_back(*beg++);
+            else             tmp.push_back(std::max(*it++, *beg++));
+        }
+        tmp.insert(tmp.end(), it, vals_.cend());
+        tmp.insert(tmp.end(), beg, end);
+        std::swap(tmp, vals_);
+    }
+    void flush() const {
+        if(buffer_.empty()) return;
+        flatten_words(buffer_);
+        merge_words(buffer_.data(), buffer_.data() + buffer_.size());
+        buffer_.clear();
+    }
+    size_t buffer_capacity() const {return std::max(MIN_BUFFER_SIZE, vals_.size() / 2);}
+    void maybe_promote() {
+        if(vals_.size() + buffer_.size() >= max_sparse_) promote();
+    }
+public:
+    // max_sparse is the number of sparse words at which the sketch becomes dense.
+    // By default, this is where the words would use as much memory as the dense registers.
+    explicit HybridHLL(unsigned np, hll::EstimationMethod estim=hll::ERTL_MLE,
+                       hll::JointEstimationMethod jestim=hll::ERTL_JOINT_MLE, size_t max_sparse=0):
+        max_sparse_(max_sparse ? max_sparse: (size_t(1) << np) / sizeof(uint32_t)), np_(np), estim_(estim), jestim_(jestim)
+    {
+        if(np > SparseHLL32::max_p()) throw std::runtime_error(std::string("p exceeds maximum ") + std::to_string(SparseHLL32::max_p()));
+        if(np < 4) throw std::runtime_error(std::string("p must be at least 4. Found ") + std::to_string(np));
+    }
+    HybridHLL(const HybridHLL &o): vals_(o.vals_), buffer_(o.buffer_), dense_(o.dense_ ? new hll::hllbase_t<HashStruct>(*o.dense_): nullptr),
+        max_sparse_(o.max_sparse_), np_(o.np_), estim_(o.estim_), jestim_(o.jestim_), hf_(o.hf_) {}
+    HybridHLL(HybridHLL &&o) = default;
+    HybridHLL &operator=(HybridHLL &&o) = default;
+    HybridHLL &operator=(const HybridHLL &o) {
+        HybridHLL tmp(o);
+        return *this = std::move(tmp);
+    }
+
+    bool is_sparse() const {return !dense_;}
+    uint32_t p() const {return np_;}
+    uint32_t q() const {return 64 - np_;}
+    uint64_t m() const {return uint64_t(1) << np_;}
+    hll::EstimationMethod get_estim()       const {return  estim_;}
+    hll::JointEstimationMethod get_jestim() const {return jestim_;}
+    // Bytes used by registers, sparse words and the insertion buffer.
+    size_t memory_usage() const {
+        return dense_ ? dense_->size(): (vals_.capacity() + buffer_.capacity()) * sizeof(uint32_t);
+    }
+
+    INLINE void add(uint64_t hashval) {
+        if(dense_) {
+            dense_->add(hashval);
+            dense_->not_ready();
+            return;
+        }
+        const uint32_t index(hashval >> q());
+        const uint8_t lzt(clz(((hashval << 1)|1) << (np_ - 1)) + 1);
+        buffer_.push_back(SparseHLL32::encode_value(index, lzt));
+        if(buffer_.size() >= buffer_capacity()) {
+            flush();
+            maybe_promote();
+        }
+    }
+    INLINE void addh(uint64_t element) {add(hf_(element));}
+    void add_batch(const uint64_t *hashes, size_t n) {
+        for(size_t i = 0; i < n; ++i) {
+            if(dense_) {
+                dense_->add_batch(hashes + i, n - i);
+                dense_->not_ready();
+                return;
+            }
+            add(hashes[i]);
+        }
+    }
+
+    // Converts to the dense representation, freeing the sparse one.
+    void promote() {
+        if(dense_) return;
+        flush();
+        dense_.reset(new hll::hllbase_t<HashStruct>(np_, estim_, jestim_));
+        uint8_t *const regs = dense_->data();
+        for(const auto w: vals_) regs[SparseHLL32::get_index(w)] = SparseHLL32::get_value(w);
+        std::vector<uint32_t>().swap(vals_);
+        std::vector<uint32_t>().swap(buffer_);
+    }
+    // Sorted SparseHLL32 words for the nonzero registers. Only valid while sparse.
+    const std::vector<uint32_t> &sparse_words() const {
+        if(dense_) throw std::runtime_error("HybridHLL has been promoted to a dense sketch.");
+        flush();
+        return vals_;
+    }
+    // Promotes the sketch and returns its dense registers.
+    const hll::hllbase_t<HashStruct> &dense() {
+        promote();
+        return *dense_;
+    }
+    hll::hllbase_t<HashStruct> to_hll() const {
+        if(dense_) return *dense_;
+        flush();
+        hll::hllbase_t<HashStruct> ret(np_, estim_, jestim_);
+        for(const auto w: vals_) ret.data()[SparseHLL32::get_index(w)] = SparseHLL32::get_value(w);
+        return ret;
+    }
+
+    std::array<uint32_t, 64> sum_counts() const {
+        if(dense_) return hll::detail::sum_counts(dense_->core());
+        flush();
+        std::array<uint32_t, 64> ret{0};
+        for(const auto w: vals_) ++ret[SparseHLL32::get_value(w)];
+        ret[0] = m() - vals_.size();
+        return ret;
+    }
+    // Every update to the dense sketch invalidates its cached estimate, so repeated reports reuse it.
+    double report() const {
+        if(dense_) return dense_->report();
+        return hll::detail::calculate_estimate(sum_counts(), estim_, m(), np_, hll::make_alpha(m()));
+    }
+    double cardinality_estimate() const {return report();}
+
+    // As hllbase_t's ertl_joint, without densifying: sparse pairs are merged, and sparse-dense pairs scan the dense histogram.
+    std::array<double, 3> ertl_joint(const HybridHLL &o) const {
+        if(o.np_ != np_) throw std::runtime_error(std::string("p (") + std::to_string(np_) + ") != other.p (" + std::to_string(o.np_) + ")");
+        hll::detail::joint_counts_t jc;
+        if(dense_ && o.dense_) return hll::ertl_joint(*dense_, *o.dense_);
+        if(dense_) {
+            o.flush();
+            jc = joint_counts(o.vals_.cbegin(), o.vals_.cend(), *dense_);
+            std::swap(jc.cg1, jc.cg2);
+        } else {
+            flush();
+            if(o.dense_) jc = joint_counts(vals_.cbegin(), vals_.cend(), *o.dense_);
+            else {
+                o.flush();
+                jc = joint_counts(vals_.cbegin(), vals_.cend(), o.vals_.cbegin(), o.vals_.cend(), np_);
+            }
+        }
+        std::array<double, 3> ret;
+        if(jestim_ != hll::ERTL_JOINT_MLE) {
+            ret[2] = hll::detail::calculate_estimate(jc.cu, estim_, m(), np_, hll::make_alpha(m()));
+            ret[0] = report();
+            ret[1] = o.report();
+            ret[2] = ret[0] + ret[1] - ret[2];
+            ret[0] -= ret[2];
+            ret[1] -= ret[2];
+            ret[2] = std::max(ret[2], 0.);
+            return ret;
+        }
+        return hll::detail::ertl_joint_estimate(jc.cu, jc.cg1, jc.cg2, jc.ceq, hll::detail::ertl_ml_estimate(sum_counts(), np_, q()),
+                                                hll::detail::ertl_ml_estimate(o.sum_counts(), np_, q()), np_, q());
+    }
+    double union_size(const HybridHLL &o) const {
+        const auto full_cmps = ertl_joint(o);
+        return full_cmps[0] + full_cmps[1] + full_cmps[2];
+    }
+    double jaccard_index(const HybridHLL &o) const {
+        const auto full_cmps = ertl_joint(o);
+        return full_cmps[2] / (full_cmps[0] + full_cmps[1] + full_cmps[2]);
+    }
+    double containment_index(const HybridHLL &o) const {
+        const auto full_cmps = ertl_joint(o);
+        return full_cmps[2] / (full_cmps[0] + full_cmps[2]);
+    }
+
+    HybridHLL &operator+=(const HybridHLL &o) {
+        if(o.np_ != np_) throw std::runtime_error(std::string("p (") + std::to_string(np_) + ") != other.p (" + std::to_string(o.np_) + ")");
+        if(o.dense_) return *this += *o.dense_;
+        if(dense_) {
+            o.flush();
+            uint8_t *const regs = dense_->data();
+            for(const auto w: o.vals_)
+                regs[SparseHLL32::get_index(w)] = std::max(regs[SparseHLL32::get_index(w)], SparseHLL32::get_value(w));
+            dense_->not_ready();
+            return *this;
+        }
+        flush();
+        o.flush();
+        merge_words(o.vals_.data(), o.vals_.data() + o.vals_.size());
+        maybe_promote();
+        return *this;
+    }
+    HybridHLL &operator+=(const hll::hllbase_t<HashStruct> &o) {
+        promote();
+        *dense_ += o;
+        return *this;
+    }
+    HybridHLL operator+(const HybridHLL &o) const {
+        HybridHLL ret(*this);
+        ret += o;
+        return ret;
+    }
+    void clear() {
+        dense_.reset();
+        vals_.clear();
+        buffer_.clear();
+    }
+};
+
 template<typename Container, typename HashStruct>
 inline std::array<double, 3> pair_query(const Container &con, const hll::hllbase_t<HashStruct> &hll, const std::array<uint32_t, 64> *a=nullptr) {
     std::array<uint32_t, 64> *tmp = a ? nullptr: reinterpret_cast<std::array<uint32_t, 64> *>(__builtin_alloca(sizeof(*a)));
@@ -245,7 +798,7 @@ inline std::array<double, 3> pair_query(const Container &con, const hll::hllbase
     return std::array<double, 3>{std::max(myrep - is, 0.), std::max(orep - is, 0.), std::max(is, 0.)};
 }
 
-template<typename Container, typename HashStruct>
+template<typename Container>
 inline std::array<double, 3> pair_query(const Container &con, const Container &c2, const int p) {
     std::array<uint32_t, 64> lsum{0}, rsum{0}, usum{0};
     lsum[0] = (1ul << p) - con.size();
@@ -257,7 +810,7 @@ inline std::array<double, 3> pair_query(const Container &con, const Container &c
             ++usum[ir->second];
             ++ir;
         } else if(ir->first > il->first) {
-            ++rsum[il->second];
+            ++lsum[il->second];
             ++usum[il->second];
             ++il;
         } else {
@@ -270,11 +823,14 @@ inline std::array<double, 3> pair_query(const Container &con, const Container &c
     while(il != el) {
         ++usum[il->second];
         ++lsum[il->second];
+        ++il;
     }
     while(ir != er) {
         ++usum[ir->second];
         ++rsum[ir->second];
+        ++ir;
     }
+    usum[0] = (1ul << p) - std::accumulate(usum.begin() + 1, usum.end(), size_t(0));
     double myrep = hll::detail::ertl_ml_estimate(lsum, p, 64 - p),
             orep = hll::detail::ertl_ml_estimate(rsum, p, 64 - p),
               us = hll::detail::ertl_ml_estimate(usum, p, 64 - p),
@@ -0,0 +1,70 @@
+#include "archive.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace archive;
+
+int main() {
+    wy::WyHash<uint64_t> gen(13);
+    std::vector<hll::hll_t> hlls;
+    std::vector<bf::bf_t> bfs;
+    std::vector<mh::FinalBBitMinHash> bbmhs;
+    std::vector<mh::FinalRMinHash<uint64_t>> rmhs;
+    for(size_t i = 0; i < 50; ++i) {
+        hll::hll_t h(8 + i % 7);
+        bf::bf_t b(10 + i % 4, 1 + i % 3, 137 + i);
+        mh::BBitMinHasher<uint64_t> bb(10, 16);
+        mh::RangeMinHash<uint64_t> rm(64);
+        for(size_t j = 0, n = 10 << (i % 10); j < n; ++j) {
+            const uint64_t v = gen();
+            h.addh(v); b.addh(v); bb.addh(v); rm.addh(v);
+        }
+        hlls.emplace_back(std::move(h));
+        bfs.emplace_back(std::move(b));
+        bbmhs.emplace_back(bb.finalize());
+        rmhs.emplace_back(rm.finalize());
+    }
+    {
+        archive_writer_t writer("archivetest.skar");
+        for(size_t i = 0; i < hlls.size(); ++i) {
+            writer.add("hll" + std::to_string(i), hlls[i]);
+            writer.add("bf" + std::to_string(i), bfs[i]);
+            writer.add("bbmh" + std::to_string(i), bbmhs[i]);
+            writer.add("rmh" + std::to_string(i), rmhs[i]);
+        }
+    }
+    archive_t ar("archivetest.skar");
+    CHECK(ar.size() == 4 * hlls.size());
+    for(size_t i = 0; i < ar.size(); ++i) {
+        CHECK(reinterpret_cast<uintptr_t>(ar.payload(i)) % ALIGNMENT == 0);
+        CHECK(ar.index(ar.name(i)) == i);
+    }
+    CHECK(!ar.contains("hll50"));
+    for(size_t i = 0; i < hlls.size(); ++i) {
+        const std::string suffix = std::to_string(i);
+        CHECK(ar.get<hll::hll_t>("hll" + suffix) == hlls[i]);
+        CHECK(std::memcmp(ar.payload(ar.index("hll" + suffix)), hlls[i].data(), hlls[i].size()) == 0);
+        const auto b = ar.get<bf::bf_t>("bf" + suffix);
+        CHECK(b.core() == bfs[i].core() && b.seeds() == bfs[i].seeds() && b.same_params(bfs[i]));
+        const auto bb = ar.get<mh::FinalBBitMinHash>("bbmh" + suffix);
+        CHECK(bb.core_ == bbmhs[i].core_ && bb.p_ == bbmhs[i].p_ && bb.b_ == bbmhs[i].b_ && bb.est_cardinality_ == bbmhs[i].est_cardinality_);
+        CHECK(ar.get<mh::FinalRMinHash<uint64_t>>("rmh" + suffix).first == rmhs[i].first);
+    }
+    bool threw = false;
+    try {ar.get<bf::bf_t>("hll0");} catch(const std::runtime_error &) {threw = true;}
+    CHECK(threw);
+    std::vector<size_t> indices;
+    for(size_t i = 0; i < hlls.size(); ++i) indices.push_back(ar.index("hll" + std::to_string(i)));
+    const auto loaded = ar.load<hll::hll_t>(indices, 4);
+    CHECK(loaded.size() == hlls.size());
+    for(size_t i = 0; i < hlls.size(); ++i) CHECK(loaded[i] == hlls[i]);
+    // A sketch that fails to decode in a worker thread throws on the calling thread.
+    indices.clear();
+    for(size_t i = 0; i < bfs.size(); ++i) indices.push_back(ar.index("bf" + std::to_string(i)));
+    threw = false;
+    try {ar.load<bf::sbf_t>(indices, 4);} catch(const std::runtime_error &) {threw = true;}
+    CHECK(threw);
+    std::remove("archivetest.skar");
+    std::fprintf(stderr, "All archive tests passed.\n");
+    return EXIT_SUCCESS;
+}
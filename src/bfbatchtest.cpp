@@ -0,0 +1,43 @@
+#include "bf.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace bf;
+
+// Batch insertion sets the same bits as addh, and batch queries agree with may_contain, for lengths around the window size.
+template<typename Filter>
+int check_batch(unsigned l2sz, unsigned nh) {
+    wy::WyHash<uint64_t> gen(13 + nh);
+    const size_t n = 20000;
+    std::vector<uint64_t> vals(n), queries(n);
+    for(auto &v: vals) v = gen();
+    for(size_t i = 0; i < n; ++i) queries[i] = i % 3 ? gen(): vals[i];
+    Filter f1(l2sz, nh, 137), f2(l2sz, nh, 137);
+    for(const auto v: vals) f1.addh(v);
+    f2.addh_batch(vals);
+    CHECK(f1.core() == f2.core());
+    std::vector<uint64_t> bitmap;
+    for(const size_t nq: {size_t(0), size_t(1), Filter::BATCH_WINDOW - 1, Filter::BATCH_WINDOW, Filter::BATCH_WINDOW + 1,
+                          2 * Filter::BATCH_WINDOW + 1, size_t(64), size_t(65), n}) {
+        bitmap.assign(n / 64 + 2, UINT64_C(0x5555555555555555));
+        f1.may_contain(queries.data(), nq, bitmap.data());
+        for(size_t i = 0; i < nq; ++i) CHECK(bool(bitmap[i >> 6] >> (i & 63) & 1) == f1.may_contain(queries[i]));
+        for(size_t i = nq; i < (nq + 63) / 64 * 64; ++i) CHECK(!(bitmap[i >> 6] >> (i & 63) & 1));
+        CHECK(bitmap[(nq + 63) / 64] == UINT64_C(0x5555555555555555));
+    }
+    f1.may_contain(vals, bitmap);
+    CHECK(bitmap.size() == (n + 63) / 64);
+    for(size_t i = 0; i < n; ++i) CHECK(bitmap[i >> 6] >> (i & 63) & 1);
+    return EXIT_SUCCESS;
+}
+
+int main() {
+    for(const unsigned nh: {1, 3, 8, 21})
+        for(const unsigned l2sz: {10, 24}) // Batches into the larger filter are pipelined.
+            if(check_batch<bf_t>(l2sz, nh)) return EXIT_FAILURE;
+    CHECK(!sbf_t(20, 0, 137).pipelines_batches() && sbf_t(24, 0, 137).pipelines_batches());
+    for(const unsigned l2sz: {6, 10, 24})
+        if(check_batch<sbf_t>(l2sz, 0)) return EXIT_FAILURE;
+    std::fprintf(stderr, "All batch Bloom filter tests passed.\n");
+    return EXIT_SUCCESS;
+}
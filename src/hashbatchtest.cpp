@@ -0,0 +1,70 @@
+#include "common.h"
+#include "hash.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hash;
+
+// A hasher without hash_batch, to exercise the scalar fallback of the free function.
+struct PlainHasher {
+    uint64_t operator()(uint64_t x) const {return x * UINT64_C(0x9E3779B97F4A7C15);}
+};
+
+// Checks that hf.hash_batch matches hf one key at a time, for lengths covering every tail size, both out of place and in place.
+template<typename Hasher>
+bool check_batch(const Hasher &hf, const std::vector<uint64_t> &vals, const char *name) {
+    std::vector<uint64_t> out(vals.size()), inplace;
+    for(const size_t n: {size_t(0), size_t(1), size_t(2), size_t(3), size_t(7), size_t(8), size_t(9), size_t(17), vals.size()}) {
+        hash_batch(hf, vals.data(), out.data(), n);
+        inplace.assign(vals.begin(), vals.begin() + n);
+        hash_batch(hf, inplace.data(), inplace.data(), n);
+        for(size_t i = 0; i < n; ++i) {
+            if(out[i] != hf(vals[i]) || inplace[i] != out[i]) {
+                std::fprintf(stderr, "%s: mismatch at %zu of %zu\n", name, i, n);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    const auto vals = test::random_keys(1003);
+    CHECK(check_batch(WangHash(), vals, "WangHash"));
+    CHECK(check_batch(MurFinHash(), vals, "MurFinHash"));
+    CHECK(check_batch(KWiseIndependentPolynomialHash<4>(), vals, "KWiseIndependentPolynomialHash<4>"));
+    CHECK(check_batch(InvMul(13), vals, "InvMul"));
+    CHECK(check_batch(InvAdd(13), vals, "InvAdd"));
+    CHECK(check_batch(InvXor(13), vals, "InvXor"));
+    CHECK(check_batch(RotN<33>(0), vals, "RotN<33>"));
+    CHECK(check_batch(RotL<13>(), vals, "RotL<13>"));
+    CHECK(check_batch(BitFlip(), vals, "BitFlip"));
+    CHECK(check_batch(XORConstantHasher<>(), vals, "XORConstantHasher"));
+    CHECK(check_batch(LShiftXor<4>(), vals, "LShiftXor<4>"));
+    CHECK(check_batch(InvLShiftXor<4>(), vals, "InvLShiftXor<4>"));
+    CHECK(check_batch(RShiftXor<4>(), vals, "RShiftXor<4>"));
+    CHECK(check_batch(InvRShiftXor<4>(), vals, "InvRShiftXor<4>"));
+    CHECK(check_batch(XorMultiply(13, 17), vals, "XorMultiply"));
+    CHECK(check_batch(MultiplyAdd(13, 17), vals, "MultiplyAdd"));
+    CHECK(check_batch(MultiplyAddXor(13, 17), vals, "MultiplyAddXor"));
+    CHECK(check_batch(MultiplyAddXoRot<33>(13, 17), vals, "MultiplyAddXoRot<33>"));
+    CHECK(check_batch(XorMultiplyN<3>(), vals, "XorMultiplyN<3>"));
+    CHECK(check_batch(MultiplyAddXoRotN<31, 4>(), vals, "MultiplyAddXoRotN<31, 4>"));
+    CHECK(check_batch(MultiplyAddXorNVec(0), vals, "MultiplyAddXorNVec(0)"));
+    CHECK(check_batch(PlainHasher(), vals, "PlainHasher"));
+    KWiseHasherSet<4> set(3);
+    std::vector<uint64_t> out(vals.size());
+    for(unsigned ind = 0; ind < 3; ++ind) {
+        set.hash_batch(vals.data(), out.data(), vals.size(), ind);
+        for(size_t i = 0; i < vals.size(); ++i) CHECK(out[i] == set(vals[i], ind));
+    }
+    // The vectorized multiply used by MurFinHash and InvMul agrees with scalar multiplication.
+    for(size_t i = 0; i + Space::COUNT <= vals.size(); i += Space::COUNT) {
+        const VType x = Space::loadu(reinterpret_cast<const Type *>(vals.data() + i)),
+                    y = Space::loadu(reinterpret_cast<const Type *>(vals.data() + vals.size() - Space::COUNT - i)),
+                    p = detail::mullo64(x.simd_, y.simd_);
+        for(unsigned j = 0; j < Space::COUNT; ++j) CHECK(p.arr_[j] == x.arr_[j] * y.arr_[j]);
+    }
+    std::fprintf(stderr, "All hash_batch tests passed.\n");
+    return EXIT_SUCCESS;
+}
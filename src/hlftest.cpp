@@ -0,0 +1,72 @@
+#include "hll.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hll;
+
+int main() {
+    wy::WyHash<uint64_t> gen(13);
+    for(const size_t size: {size_t(1), size_t(3), size_t(8), size_t(64), size_t(100)}) {
+        for(const unsigned p: {6u, 12u}) {
+            const size_t n = size_t(1) << 14;
+            const double tol = 4. * 1.04 / std::sqrt(double(size_t(1) << p));
+            hlf_t h1(size, 137, p), h2(size, 137, p);
+            std::vector<hll_t> subs(size, hll_t(p));
+            std::vector<uint64_t> vals(n);
+            for(auto &v: vals) v = gen();
+            const uint64_t *seeds = h1.seeds();
+            for(size_t i = 0; i < n; ++i) {
+                h1.addh(vals[i]);
+                if(i & 1) h2.addh(vals[i]);
+                else      h2.addh(~vals[i]);
+                for(size_t k = 0; k < size; ++k) subs[k].add(WangHash()(vals[i] ^ seeds[k]));
+            }
+            double mean = 0.;
+            for(size_t k = 0; k < size; ++k) {
+                CHECK(h1.sub_hll(k) == subs[k]);
+                mean += subs[k].report();
+            }
+            mean /= size;
+            CHECK(std::abs(h1.report() - mean) <= 1e-9 * mean);
+            CHECK(std::abs(h1.report() - n) < n * tol);
+            CHECK(std::abs(h1.med_report() - n) < n * tol);
+            if((size & (size - 1)) == 0) CHECK(std::abs(h1.chunk_report() - n) < n * tol);
+            for(const auto v: vals) CHECK(h1.may_contain(v));
+            const double ji = h1.jaccard_index(h2);
+            CHECK(std::abs(ji - 1. / 3) < tol);
+            hlf_t u = h1 + h2;
+            CHECK(std::abs(ji - (h1.creport() + h2.creport() - u.creport()) / u.creport()) < tol);
+            for(size_t i = 0; i < u.core().size(); ++i) CHECK(u.core()[i] == std::max(h1.core()[i], h2.core()[i]));
+            h1.write("hlftest.hlf");
+            hlf_t h3("hlftest.hlf");
+            CHECK(h3.size() == size && h3.p() == p);
+            CHECK(h3.core() == h1.core());
+            CHECK(h3.report() == h1.report());
+            {
+                // The format written before versioning: the seeds followed by each sub-sketch as an hll.
+                gzFile fp = gzopen("hlftest.hlf", "wb");
+                const uint64_t sz = size;
+                common::io::gzwrite_all(fp, &sz, sizeof(sz));
+                common::io::gzwrite_all(fp, seeds, sz * sizeof(seeds[0]));
+                for(const auto &sub: subs) sub.write(fp);
+                gzclose(fp);
+                hlf_t legacy("hlftest.hlf");
+                CHECK(legacy.size() == size && legacy.p() == p);
+                CHECK(legacy.core() == h1.core());
+                CHECK(legacy.report() == h1.report());
+            }
+            h3.addh(gen());
+            CHECK((h3 += h2).core() == (h1 + h2 + h3).core());
+            bool threw = false;
+            try {
+                h1 += hlf_t(size, 138, p);
+            } catch(const std::runtime_error &) {threw = true;}
+            CHECK(threw);
+            h1.clear();
+            CHECK(h1.report() == 0.);
+        }
+    }
+    std::remove("hlftest.hlf");
+    std::fprintf(stderr, "All hyperlogfilter tests passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+#include "hllmatrix.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hll;
+
+int main() {
+    wy::WyHash<uint64_t> gen(1337);
+    for(const unsigned p: {8u, 12u, 16u}) {
+        for(const auto jestim: {ERTL_JOINT_MLE, JointEstimationMethod(ERTL_MLE)}) {
+            const size_t n = 21;
+            std::vector<hll_t> hlls;
+            for(size_t i = 0; i < n; ++i) {
+                hlls.emplace_back(p, ERTL_MLE, jestim);
+                for(size_t j = 0; j < (size_t(100) << (i % 7)); ++j) hlls.back().addh(gen() % 20000);
+            }
+            hlls[3].sum();
+            for(const auto measure: {PAIRWISE_JACCARD_INDEX, PAIRWISE_CONTAINMENT_INDEX, PAIRWISE_UNION_SIZE, PAIRWISE_INTERSECTION_SIZE}) {
+                const auto mat = pairwise_matrix<double>(hlls, measure, 2);
+                CHECK(mat.size() == pairwise_size(n, measure));
+                size_t k = 0;
+                for(size_t i = 0; i < n; ++i) {
+                    for(size_t j = is_symmetric(measure) ? i + 1: 0; j < n; ++j) {
+                        const hll_t &a = hlls[i], &b = hlls[j];
+                        double expected;
+                        switch(measure) {
+                            case PAIRWISE_JACCARD_INDEX:     expected = a.jaccard_index(b); break;
+                            case PAIRWISE_CONTAINMENT_INDEX: expected = i == j ? 1.: a.containment_index(b); break;
+                            case PAIRWISE_UNION_SIZE:        expected = a.union_size(b); break;
+                            default:                         expected = jestim == ERTL_JOINT_MLE ? ertl_joint(a, b)[2]: intersection_size(a, b);
+                        }
+                        if(std::abs(mat[k] - expected) > 1e-9 * std::max(1., std::abs(expected))) {
+                            std::fprintf(stderr, "p %u measure %d, %zu/%zu: %lf vs %lf\n", p, int(measure), i, j, mat[k], expected);
+                            return EXIT_FAILURE;
+                        }
+                        ++k;
+                    }
+                }
+                std::FILE *fp = std::tmpfile();
+                pairwise_matrix<double>(hlls, fp, measure, 2, 5);
+                std::rewind(fp);
+                std::vector<double> streamed(mat.size());
+                CHECK(std::fread(streamed.data(), sizeof(double), streamed.size(), fp) == streamed.size());
+                CHECK(std::fgetc(fp) == EOF);
+                std::fclose(fp);
+                CHECK(streamed == mat);
+                // Pointers to sketches stored elsewhere, as the Python binding passes them.
+                std::vector<const hll_t *> ptrs;
+                for(const auto &h: hlls) ptrs.push_back(&h);
+                std::vector<double> viaptrs(mat.size());
+                pairwise_matrix(ptrs.data(), n, viaptrs.data(), measure, 2);
+                CHECK(viaptrs == mat);
+                if(!is_symmetric(measure)) continue;
+                std::vector<double> square(n * n);
+                condensed_to_square(mat.data(), n, square.data(), -1.);
+                for(size_t i = 0; i < n; ++i) {
+                    CHECK(square[i * n + i] == -1.);
+                    for(size_t j = i + 1; j < n; ++j) CHECK(square[i * n + j] == square[j * n + i] && square[i * n + j] == mat[i * n - i * (i + 1) / 2 + j - i - 1]);
+                }
+            }
+        }
+    }
+    std::fprintf(stderr, "All pairwise matrix tests passed.\n");
+    return EXIT_SUCCESS;
+}
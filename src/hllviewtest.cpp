@@ -0,0 +1,42 @@
+#include "hllview.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hll;
+
+int main() {
+    wy::WyHash<uint64_t> gen(137);
+    for(const unsigned p: {6u, 12u, 16u}) {
+        hll_t d1(p), d2(p);
+        for(size_t i = 0; i < (size_t(1) << 16); ++i) {
+            const uint64_t shared = gen();
+            d1.addh(gen()); d2.addh(gen());
+            d1.addh(shared); d2.addh(shared);
+        }
+        d1.write("hllviewtest1.hll", false);
+        d1.sum();
+        d2.write("hllviewtest2.hll", false);
+        hllview_t v1("hllviewtest1.hll"), v2("hllviewtest2.hll");
+        CHECK(v1.p() == p);
+        CHECK(!v1.get_is_ready());
+        CHECK(v1.to_hll() == d1);
+        CHECK(v1.report() == d1.report());
+        CHECK(v1.union_size(v2) == d1.union_size(d2));
+        CHECK(v1.union_size(d2) == d1.union_size(d2));
+        CHECK(v1.jaccard_index(v2) == d1.jaccard_index(d2));
+        CHECK(v1.containment_index(v2) == d1.containment_index(d2));
+        CHECK(v2.containment_index(v1) == d2.containment_index(d1));
+        CHECK(ertl_joint(v1, v2) == ertl_joint(d1, d2));
+        d1.write("hllviewtest1.hll", false);
+        CHECK(hllview_t("hllviewtest1.hll").get_is_ready());
+        CHECK(hllview_t("hllviewtest1.hll").report() == d1.report());
+        bool threw = false;
+        d1.write("hllviewtest1.hll", true);
+        try {hllview_t v("hllviewtest1.hll");} catch(const std::runtime_error &) {threw = true;}
+        CHECK(threw);
+    }
+    std::remove("hllviewtest1.hll");
+    std::remove("hllviewtest2.hll");
+    std::fprintf(stderr, "All hll view tests passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include "sparse.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hll;
+using namespace sparse;
+
+std::vector<std::pair<uint32_t, uint8_t>> to_pairs(const hll_t &h) {
+    std::vector<std::pair<uint32_t, uint8_t>> ret;
+    for(uint32_t i = 0; i < h.size(); ++i) if(h.core()[i]) ret.emplace_back(i, h.core()[i]);
+    return ret;
+}
+
+int main() {
+    wy::WyHash<uint64_t> gen(13);
+    for(const unsigned p: {8u, 12u, 16u}) {
+        for(const size_t n: {size_t(0), size_t(10), size_t(300), size_t(1) << 16}) {
+            hll_t d1(p), d2(p);
+            HybridHLL<> h1(p), h2(p);
+            for(size_t i = 0; i < n; ++i) {
+                const uint64_t v = gen();
+                d1.addh(v); h1.addh(v);
+                d2.addh(v ^ 1); h2.addh(v ^ 1);
+                if(i % 4 == 0) d1.addh(i), h1.addh(i); // Repeated registers in the buffer
+            }
+            if(n * 5 / 4 < d1.m() / 8) CHECK(h1.is_sparse());
+            if(n >= d1.m() / 4) CHECK(!h1.is_sparse());
+            d1.not_ready(); d2.not_ready();
+            CHECK(h1.to_hll() == d1);
+            CHECK(h1.report() == d1.report());
+            CHECK(h1.sum_counts() == hll::detail::sum_counts(d1.core()));
+            if(h1.is_sparse()) {
+                CHECK(std::is_sorted(h1.sparse_words().begin(), h1.sparse_words().end()));
+                CHECK(h1.memory_usage() < d1.size());
+            }
+            SparseHLL<> s1(d1), s2(d2);
+            if(n) { // Similarities of empty sketches are NaN
+                CHECK(h1.jaccard_index(h2) == d1.jaccard_index(d2));
+                CHECK(h1.containment_index(h2) == d1.containment_index(d2));
+                CHECK(h1.union_size(h2) == d1.union_size(d2));
+                CHECK(s1.query(s2) == s1.query(d2));
+                CHECK(s1.jaccard_index(s2) == s1.jaccard_index(d2));
+            }
+            const std::vector<std::pair<uint32_t, uint8_t>> pairs1 = to_pairs(d1), pairs2 = to_pairs(d2);
+            CHECK(pair_query(pairs1, pairs2, p) == s1.query(s2));
+            CHECK((h1 + h2).to_hll() == d1 + d2);
+            h2.promote();
+            CHECK(!h2.is_sparse());
+            if(n) { // Sparse against dense
+                CHECK(h1.jaccard_index(h2) == d1.jaccard_index(d2));
+                CHECK(h2.containment_index(h1) == d2.containment_index(d1));
+            }
+            { // Merging a sparse sketch or inserting into a dense one invalidates its cached estimate.
+                HybridHLL<> h3(h2), few(p);
+                hll_t d3(d2);
+                h3.report();
+                for(uint64_t i = 0; i < 16; ++i) few.addh(i + n), d3.addh(i + n);
+                h3 += few;
+                d3.not_ready();
+                CHECK(h3.jaccard_index(h2) == d3.jaccard_index(d2));
+                CHECK(h3.report() == d3.report());
+                h3.addh(n + 1000), d3.addh(n + 1000);
+                d3.not_ready();
+                CHECK(h3.report() == d3.report());
+            }
+            HybridHLL<> u = h1 + h2;
+            d1 += d2;
+            CHECK(u.to_hll() == d1);
+            CHECK(u.report() == d1.report());
+            h1 += h2;
+            CHECK(h1.to_hll() == d1);
+            CHECK(h1.dense() == d1);
+        }
+    }
+    for(const unsigned p: {10u, 18u, 26u}) {
+        for(const size_t n: {size_t(0), size_t(3), size_t(100), size_t(5000)}) {
+            hll_t d1(p), d2(p);
+            for(size_t i = 0; i < n; ++i) {
+                const uint64_t v = gen();
+                d1.addh(v); d2.addh(i & 1 ? v: gen());
+            }
+            SparseHLL<> s1(d1), s2(d2);
+            const auto buf = s1.serialize();
+            sparse_view_t view(buf);
+            CHECK(view.size() == s1.size() && view.serialized_size() == buf.size());
+            CHECK(std::equal(view.begin(), view.end(), s1.begin(), s1.end()));
+            CHECK(SparseHLL<>(view) == s1);
+            CHECK(view.sum() == s1.sum());
+            if(n >= 100 && (size_t(1) << p) / n < (1u << 16)) CHECK(buf.size() < sizeof(uint32_t) * s1.size()); // Gaps fit in 2 bytes
+            if(n) { // Control bytes which disagree with the length of the delta data are rejected.
+                auto bad = buf;
+                bad[SPARSE_HEADER_SIZE] ^= 0x3;
+                bool threw = false;
+                try {sparse_view_t badview(bad);} catch(const std::runtime_error &) {threw = true;}
+                CHECK(threw);
+            }
+            if(p == 10) { // Indices which repeat, decrease or exceed 2**p are rejected.
+                for(const std::vector<uint32_t> indices: {std::vector<uint32_t>{7, 7}, std::vector<uint32_t>{9, 3}, std::vector<uint32_t>{1u << p}}) {
+                    std::vector<uint32_t> words;
+                    for(const auto i: indices) words.push_back(SparseHLL32::encode_value(i, 1));
+                    std::vector<uint8_t> bad;
+                    encode_words(words.data(), words.size(), p, bad);
+                    bool threw = false;
+                    try {sparse_view_t badview(bad);} catch(const std::runtime_error &) {threw = true;}
+                    CHECK(threw);
+                }
+            }
+            if(n) {
+                CHECK(view.query(s2) == s1.query(s2));
+                CHECK(s2.jaccard_index(view) == s2.jaccard_index(s1));
+            }
+            s1.write("hybridtest.sparse");
+            CHECK(SparseHLL<>("hybridtest.sparse") == s1);
+            s2.write("hybridtest.sparse", true);
+            CHECK(SparseHLL<>("hybridtest.sparse") == s2);
+        }
+    }
+    std::remove("hybridtest.sparse");
+    std::fprintf(stderr, "All hybrid hll tests passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+#include "common.h"
+#include "hash.h"
+#include "ccm.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hash;
+
+static constexpr uint64_t MOD61 = (uint64_t(1) << 61) - 1;
+
+int main() {
+    auto vals = test::random_keys(4099);
+    // Keys at and around multiples of the modulus and the ends of the range
+    const uint64_t edges[] {0, 1, MOD61 - 1, MOD61, MOD61 + 1, uint64_t(1) << 61, MOD61 * 2, MOD61 * 8, uint64_t(-1), uint64_t(-2), uint64_t(1) << 63};
+    std::copy(std::begin(edges), std::end(edges), vals.begin());
+
+#ifdef NO_USE_SIAM
+    // Lane-wise modular multiplication agrees with the scalar version, including for operands of 2^61-1.
+    for(size_t i = 0; i + Space::COUNT <= vals.size(); i += Space::COUNT) {
+        VType x, y;
+        for(unsigned j = 0; j < Space::COUNT; ++j) {
+            x.arr_[j] = i ? vals[i + j] & MOD61: MOD61 - j % 2;
+            y.arr_[j] = i ? vals[vals.size() - 1 - i - j] & MOD61: MOD61;
+        }
+        VType p = nosiam::canon61(nosiam::fold61(nosiam::mul61(x.simd_, y.simd_, Space::srli(y.simd_, 32))));
+        for(unsigned j = 0; j < Space::COUNT; ++j) CHECK(p.arr_[j] == nosiam::mulmod61(x.arr_[j], y.arr_[j]) % MOD61);
+    }
+#endif
+
+    // Vectors of keys under one hasher, for several degrees
+    std::vector<uint64_t> out(vals.size());
+    KWiseIndependentPolynomialHash<2> h2(7);
+    KWiseIndependentPolynomialHash<4> h4(7);
+    KWiseIndependentPolynomialHash<9> h9(7);
+    h2.hash_batch(vals.data(), out.data(), vals.size());
+    for(size_t i = 0; i < vals.size(); ++i) CHECK(out[i] == h2(vals[i]));
+    h4.hash_batch(vals.data(), out.data(), vals.size());
+    for(size_t i = 0; i < vals.size(); ++i) CHECK(out[i] == h4(vals[i]) && out[i] < MOD61);
+    h9.hash_batch(vals.data(), out.data(), vals.size());
+    for(size_t i = 0; i < vals.size(); ++i) CHECK(out[i] == h9(vals[i]));
+
+    // One key under every hasher of a set, for set sizes covering every partial vector
+    for(size_t nh = 1; nh <= 2 * Space::COUNT + 1; ++nh) {
+        KWiseHasherSet<4> set(nh, 31);
+        CHECK(set.size() == nh);
+        std::vector<uint64_t> hashes(nh + 1, 137);
+        for(size_t i = 0; i < 256; ++i) {
+            set.hash_all(vals[i], hashes.data());
+            for(unsigned j = 0; j < nh; ++j) CHECK(hashes[j] == set(vals[i], j));
+            CHECK(hashes[nh] == 137);
+        }
+    }
+
+    // Count sketches updated through hash_all match those updated one row at a time.
+    cm::cs4w_t cs(10, 5), cs2(10, 5);
+    for(size_t i = 0; i < vals.size(); ++i) {
+        cs.addh(vals[i] % 512);
+        for(unsigned j = 0; j < 5; ++j) cs2.add(vals[i] % 512, j);
+    }
+    for(uint64_t i = 0; i < 512; ++i) CHECK(cs.est_count(i) == cs2.est_count(i));
+    std::fprintf(stderr, "All k-wise hash tests passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#include "packedhll.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hll;
+
+int main() {
+    wy::WyHash<uint64_t> gen(13);
+    for(const unsigned p: {6u, 10u, 14u, 18u}) {
+        for(const size_t n: {size_t(100), size_t(1) << 16}) {
+            hll_t d1(p), d2(p);
+            packedhll_t p1(p), p2(p);
+            for(size_t i = 0; i < n; ++i) {
+                const uint64_t v = gen(), shared = gen();
+                d1.addh(v); p1.addh(v);
+                d2.addh(v ^ 1); p2.addh(v ^ 1);
+                d1.addh(shared); p1.addh(shared);
+                d2.addh(shared); p2.addh(shared);
+            }
+            CHECK(p1.to_hll() == d1);
+            CHECK(packedhll_t(d1) == p1);
+            for(size_t i = 0; i < d1.size(); ++i) CHECK(p1[i] == d1.core()[i]);
+            CHECK(p1.report() == d1.report());
+            CHECK(p1.union_size(p2) == d1.union_size(d2));
+            CHECK(p1.union_size(d2) == d1.union_size(d2));
+            CHECK(p1.jaccard_index(p2) == d1.jaccard_index(d2));
+            CHECK(p1.containment_index(p2) == d1.containment_index(d2));
+            CHECK(ertl_joint(p1, p2) == ertl_joint(d1, d2));
+            p1.write("packedtest.hll");
+            CHECK(hll_t("packedtest.hll") == d1);
+            d2.write("packedtest.hll", true);
+            CHECK(packedhll_t("packedtest.hll") == p2);
+            p1 += p2;
+            d1 += d2;
+            CHECK(p1.to_hll() == d1);
+            CHECK(p1.report() == d1.report());
+        }
+    }
+    for(const unsigned p: {6u, 10u, 14u}) {
+        for(const size_t n: {size_t(10), size_t(1) << 12, size_t(1) << 20}) {
+            hll_t d1(p), d2(p);
+            hll4_t h1(p), h2(p);
+            for(size_t i = 0; i < n; ++i) {
+                const uint64_t v = gen(), shared = gen();
+                d1.addh(v); h1.addh(v);
+                d2.addh(v ^ 1); h2.addh(v ^ 1);
+                d1.addh(shared); h1.addh(shared);
+                d2.addh(shared); h2.addh(shared);
+            }
+            CHECK(h1.to_hll() == d1);
+            CHECK(hll4_t(d1) == h1);
+            CHECK(h1.base() == *std::min_element(d1.core().begin(), d1.core().end()));
+            for(size_t i = 0; i < d1.size(); ++i) CHECK(h1[i] == d1.core()[i]);
+            CHECK(h1.report() == d1.report());
+            CHECK(h1.union_size(h2) == d1.union_size(d2));
+            CHECK(h1.union_size(d2) == d1.union_size(d2));
+            CHECK(h1.jaccard_index(h2) == d1.jaccard_index(d2));
+            CHECK(h1.jaccard_index(d2) == d1.jaccard_index(d2));
+            CHECK(h1.containment_index(h2) == d1.containment_index(d2));
+            CHECK(ertl_joint(h1, h2) == ertl_joint(d1, d2));
+            h1.write("packedtest.hll");
+            CHECK(hll_t("packedtest.hll") == d1);
+            d2.write("packedtest.hll", true);
+            CHECK(hll4_t("packedtest.hll") == h2);
+            h1 += d2;
+            d1 += d2;
+            CHECK(h1.to_hll() == d1);
+            h2 += h1;
+            CHECK(h2.to_hll() == d1);
+            CHECK(h2.report() == d1.report());
+        }
+    }
+    std::remove("packedtest.hll");
+    std::fprintf(stderr, "All packed hll tests passed.\n");
+    return EXIT_SUCCESS;
+}
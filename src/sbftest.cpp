@@ -0,0 +1,83 @@
+#include "bf.h"
+#include "archive.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace bf;
+
+int main() {
+    const size_t n = 100000;
+    const auto vals = test::random_keys(n, 13), others = test::random_keys(n, 14);
+
+    // Each key sets one bit in each 32-bit word of a single block, matching the scalar definition on every build.
+    sbf_t one(20, 0, 137);
+    CHECK(one.nhashes() == sbf_t::BLOCK_HASHES && one.size() == size_t(1) << 20);
+    one.addh(vals[0]);
+    const uint64_t hv = WangHash()(vals[0] ^ one.seeds()[0]);
+    const size_t blockind = (hv >> 32) & (one.core().size() / sbf_t::BLOCK_WORDS - 1);
+    const uint32_t *words = reinterpret_cast<const uint32_t *>(one.data() + blockind * sbf_t::BLOCK_WORDS);
+    for(unsigned i = 0; i < sbf_t::BLOCK_HASHES; ++i)
+        CHECK(words[i] == uint32_t(1) << ((uint32_t(hv) * BLOCK_SALTS[i]) >> 27));
+    CHECK(one.popcnt() == sbf_t::BLOCK_HASHES);
+    CHECK(sbf_t(4, 0, 137).size() == size_t(1) << sbf_t::BLOCK_P);
+
+    // No false negatives, and a false positive rate near that expected at 16 bits per key
+    sbf_t a(21, 0, 137), b(21, 0, 137);
+    for(size_t i = 0; i < n; ++i) a.addh(vals[i]), b.addh(i & 1 ? vals[i]: others[i]);
+    for(const auto v: vals) CHECK(a.may_contain(v));
+    size_t nfp = 0;
+    for(const auto v: others) nfp += a.may_contain(v);
+    std::fprintf(stderr, "Blocked false positive rate: %lf\n", double(nfp) / n);
+    CHECK(nfp < n / 100);
+    std::vector<uint64_t> bits;
+    a.may_contain(vals.data(), n, bits);
+    for(size_t i = 0; i < n; ++i) CHECK(bits[i >> 6] >> (i & 63) & 1);
+    a.may_contain(others.data(), n, bits);
+    for(size_t i = 0; i < n; ++i) CHECK(bool(bits[i >> 6] >> (i & 63) & 1) == a.may_contain(others[i]));
+    CHECK(std::abs(a.cardinality_estimate() - n) < n * 0.05);
+
+    // Union, intersection and similarity work on blocked filters as on standard ones.
+    sbf_t c(a | b);
+    for(size_t i = 0; i < n; ++i) CHECK(c.may_contain(vals[i]) && c.may_contain(i & 1 ? vals[i]: others[i]));
+    CHECK(a.intersection_count(a) == a.popcnt());
+    CHECK(a.intersection_count(b) == (a & b).popcnt());
+    const double ji = a.jaccard_index(b);
+    std::fprintf(stderr, "Jaccard estimate: %lf (true: %lf)\n", ji, 1. / 3);
+    CHECK(std::abs(ji - 1. / 3) < 0.05);
+    sbf_t d(a);
+    CHECK(!d.may_contain_and_addh(others[0]) || a.may_contain(others[0]));
+    CHECK(d.may_contain_and_addh(others[0]) && d.may_contain(others[0]));
+
+    // Serialization round trips, and a filter cannot be read back in the other mode.
+    a.write("sbftest.bf");
+    sbf_t e("sbftest.bf");
+    CHECK(e.core() == a.core() && e.same_params(a) && e.seeds() == a.seeds());
+    for(size_t i = 0; i < 1000; ++i) CHECK(e.may_contain(vals[i]));
+    bool threw = false;
+    try {bf_t wrongmode("sbftest.bf");} catch(const std::runtime_error &) {threw = true;}
+    CHECK(threw);
+    bf_t s(21, 4, 137);
+    for(size_t i = 0; i < 1000; ++i) s.addh(vals[i]);
+    s.write("sbftest.bf");
+    bf_t s2("sbftest.bf");
+    CHECK(s2.core() == s.core() && s2.seeds() == s.seeds() && s2.same_params(s));
+    for(size_t i = 0; i < 1000; ++i) CHECK(s2.may_contain(vals[i]));
+    threw = false;
+    try {sbf_t wrongmode("sbftest.bf");} catch(const std::runtime_error &) {threw = true;}
+    CHECK(threw);
+    std::remove("sbftest.bf");
+
+    {
+        archive::archive_writer_t writer("sbftest.skar");
+        writer.add("blocked", a);
+        writer.add("standard", s);
+    }
+    archive::archive_t ar("sbftest.skar");
+    CHECK(ar.get<sbf_t>("blocked").core() == a.core());
+    threw = false;
+    try {ar.get<sbf_t>("standard");} catch(const std::runtime_error &) {threw = true;}
+    CHECK(threw);
+    std::remove("sbftest.skar");
+    std::fprintf(stderr, "All blocked Bloom filter tests passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+#include "slidinghll.h"
+#include <set>
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hll;
+
+int main() {
+    wy::WyHash<uint64_t> gen(13);
+    for(const unsigned p: {6u, 10u, 14u}) {
+        // 200 minutes of 1000 elements each, a tenth of which repeat elements from earlier minutes.
+        const uint64_t nminutes = 200, per_minute = 1000, max_window = 120;
+        slidinghll_t sh(p, max_window), sb(p, max_window);
+        std::vector<uint64_t> vals, stamps;
+        for(uint64_t t = 0; t < nminutes; ++t) {
+            for(uint64_t i = 0; i < per_minute; ++i) {
+                vals.push_back(i % 10 == 0 && vals.size() ? vals[gen() % vals.size()]: gen());
+                stamps.push_back(t);
+                sh.addh(vals.back(), t);
+            }
+        }
+        sb.addh_batch(vals.data(), stamps.data(), vals.size());
+        CHECK(sh.latest() == nminutes - 1);
+        CHECK(sb.latest() == nminutes - 1);
+        for(const uint64_t now: {uint64_t(50), nminutes - 1}) {
+            for(const uint64_t window: {uint64_t(1), uint64_t(10), uint64_t(60), max_window}) {
+                // Registers over the window must match a sketch of exactly the elements in the window.
+                hll_t exact(p);
+                for(size_t i = 0; i < vals.size(); ++i)
+                    if(stamps[i] + window > now && stamps[i] <= now) exact.addh(vals[i]);
+                if(now == nminutes - 1) {
+                    CHECK(sh.window_hll(window) == exact);
+                    CHECK(sh.cardinality_estimate(window) == exact.report());
+                }
+                CHECK(sb.window_hll(window, now) == sh.window_hll(window, now));
+                if(now == 50) continue; // Later stamps have overwritten some of the earlier ones.
+                CHECK(sh.window_hll(window, now) == exact);
+            }
+        }
+        const double est = sh.cardinality_estimate(60);
+        std::set<uint64_t> distinct;
+        for(size_t i = 0; i < vals.size(); ++i) if(stamps[i] + 60 >= nminutes) distinct.insert(vals[i]);
+        const double truth = distinct.size();
+        CHECK(std::abs(est - truth) < truth * 4. * 1.04 / std::sqrt(double(sh.m())));
+        bool threw = false;
+        try {
+            sh.cardinality_estimate(max_window + 1);
+        } catch(const std::runtime_error &) {threw = true;}
+        CHECK(threw);
+
+        // Merging two streams matches one sketch of both.
+        slidinghll_t s1(p, max_window), s2(p, max_window);
+        for(size_t i = 0; i < vals.size(); ++i) (i & 1 ? s1: s2).addh(vals[i], stamps[i]);
+        s1 += s2;
+        CHECK(s1.window_hll(max_window) == sh.window_hll(max_window));
+        CHECK(s1.latest() == sh.latest());
+
+        // Single-stamp batches
+        slidinghll_t s3(p, max_window);
+        for(uint64_t t = 0; t < nminutes; ++t) s3.addh_batch(vals.data() + t * per_minute, per_minute, t);
+        CHECK(s3.window_hll(max_window) == sh.window_hll(max_window));
+
+        sh.write("slidinghlltest.shll");
+        slidinghll_t sr("slidinghlltest.shll");
+        CHECK(sr.p() == p && sr.max_window() == max_window && sr.latest() == sh.latest());
+        CHECK(sr.window_hll(30) == sh.window_hll(30));
+
+        // Timestamps far beyond 32 bits move the base forward without changing any window.
+        const uint64_t epoch = uint64_t(1) << 40, scale = uint64_t(1) << 24;
+        slidinghll_t sl(p, max_window * scale);
+        for(size_t i = 0; i < vals.size(); ++i) sl.addh(vals[i], epoch + stamps[i] * scale);
+        CHECK(sl.latest() == epoch + (nminutes - 1) * scale);
+        for(const uint64_t window: {uint64_t(1), uint64_t(10), max_window})
+            CHECK(sl.window_hll(window * scale) == sh.window_hll(window));
+        sl.write("slidinghlltest.shll");
+        CHECK(slidinghll_t("slidinghlltest.shll").window_hll(10 * scale) == sh.window_hll(10));
+        slidinghll_t sl2(p, max_window * scale);
+        sl2.addh_batch(vals.data(), vals.size() / 2, epoch);
+        sl2 += sl;
+        CHECK(sl2.window_hll(max_window * scale) == sh.window_hll(max_window));
+
+        // Expiry only removes stamps outside of every window.
+        sh.expire(sh.latest());
+        CHECK(sh.window_hll(max_window) == sr.window_hll(max_window));
+        sh.clear();
+        CHECK(sh.cardinality_estimate(max_window) == 0.);
+    }
+    std::remove("slidinghlltest.shll");
+    std::fprintf(stderr, "All sliding hll tests passed.\n");
+    return EXIT_SUCCESS;
+}
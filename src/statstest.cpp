@@ -0,0 +1,97 @@
+#include "hll.h"
+#include "bf.h"
+#include "ccm.h"
+#include "testutil.h"
+
+using namespace sketch;
+using namespace hll;
+
+int main() {
+#ifdef DISABLE_SKETCH_STATS
+    std::fprintf(stderr, "Stats are compiled out; nothing to test.\n");
+    return EXIT_SUCCESS;
+#endif
+    const size_t n = size_t(1) << 16;
+    const unsigned nthreads = 4;
+    const auto vals = test::random_keys(n);
+
+    // Nothing is recorded while disabled.
+    stats::reset();
+    hll_t h(12);
+    for(const auto v: vals) h.addh(v);
+    h.report();
+    for(const auto c: stats::snapshot().counters) CHECK(c == 0);
+
+    stats::enable();
+    CHECK(stats::enabled());
+    // Single insertions on one thread
+    h.clear();
+    for(const auto v: vals) h.addh(v);
+    auto s = stats::snapshot();
+    CHECK(s[stats::INSERTS] == n);
+    CHECK(s[stats::REGISTER_UPDATES] > 0 && s[stats::REGISTER_UPDATES] < n);
+    CHECK(s[stats::CAS_RETRIES] == 0);
+    CHECK(std::accumulate(s.ranks.begin(), s.ranks.end(), uint64_t(0)) == n);
+    CHECK(s.ranks[0] == 0 && s.ranks[1] > s.ranks[2]);
+    // Re-inserting changes no registers.
+    for(const auto v: vals) h.addh(v);
+    CHECK((stats::snapshot() - s)[stats::REGISTER_UPDATES] == 0);
+    h.not_ready();
+    h.report();
+    CHECK(stats::snapshot()[stats::ESTIMATOR_ITERATIONS] > 0);
+
+    // Counters of threads are aggregated, including those of threads which have exited,
+    // and batch insertion into a shared sketch records the same totals.
+    stats::reset();
+    hll_t shared(12);
+    std::vector<hll_t> own(nthreads, hll_t(12));
+    std::vector<std::thread> threads;
+    for(unsigned t = 0; t < nthreads; ++t)
+        threads.emplace_back([&,t]() {
+            own[t].addh_batch(vals.data(), n);
+            shared.addh_batch(vals.data() + t * (n / nthreads), n / nthreads);
+        });
+    for(auto &t: threads) t.join();
+    s = stats::snapshot();
+    CHECK(s[stats::INSERTS] == n * nthreads + n);
+    CHECK(std::accumulate(s.ranks.begin(), s.ranks.end(), uint64_t(0)) == s[stats::INSERTS]);
+    uint64_t nonzero = std::count_if(shared.core().begin(), shared.core().end(), [](uint8_t r) {return r != 0;});
+    CHECK(s[stats::REGISTER_UPDATES] >= nthreads * nonzero);
+    std::fprintf(stderr, "%s", s.to_string().data());
+    std::fprintf(stderr, "update rate: %lf. retry rate: %lf\n", s.update_rate(), s.retry_rate());
+
+    // Merges of hll_t and hlf_t
+    for(const auto &o: own) shared += o;
+    hlf_t f1(4, 137, 10), f2(4, 137, 10);
+    f1.addh(vals[0]);
+    f1 += f2;
+    s = stats::snapshot();
+    CHECK(s[stats::MERGES] == nthreads + 1);
+    CHECK(s[stats::INSERTS] == n * nthreads + n + 4);
+
+    // Bloom filters and count sketches record inserts and merges, but not register updates or ranks.
+    stats::reset();
+    bf::bf_t b1(12, 4, 137), b2(12, 4, 137);
+    bf::sbf_t sb(12, 4, 137);
+    cm::cs_t c1(10, 3), c2(10, 3);
+    cm::cs4w_t w1(10, 3), w2(10, 3);
+    cm::ccm_t m1(8, 10, 3), m2(8, 10, 3);
+    for(size_t i = 0; i < 100; ++i) b1.addh(vals[i]), c1.addh(vals[i]), w1.addh(vals[i]), m1.addh(vals[i]);
+    b2.addh_batch(vals.data(), 100);
+    sb.addh_batch(vals.data(), 100);
+    b1 |= b2; c1 += c2; w1 += w2; m1 += m2;
+    s = stats::snapshot();
+    CHECK(s[stats::INSERTS] == 600);
+    CHECK(s[stats::MERGES] == 4);
+    CHECK(s[stats::REGISTER_UPDATES] == 0);
+    CHECK(std::accumulate(s.ranks.begin(), s.ranks.end(), uint64_t(0)) == 0);
+
+    stats::disable();
+    CHECK(!stats::enabled());
+    shared.addh(vals[0]);
+    CHECK(stats::snapshot()[stats::INSERTS] == s[stats::INSERTS]);
+    stats::reset();
+    CHECK(stats::snapshot()[stats::INSERTS] == 0);
+    std::fprintf(stderr, "All stats tests passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+#include "hll.h"
+#include "bf.h"
+#include "ccm.h"
+#include "mh.h"
+#include "strhash.h"
+#include "testutil.h"
+
+using namespace sketch;
+
+int main() {
+    wy::WyHash<uint64_t> gen(13);
+    std::vector<std::string> strs(10007);
+    for(auto &s: strs) {
+        s.resize(gen() % 200);
+        for(auto &c: s) c = 'a' + gen() % 26;
+    }
+    const hash::XXH3Hasher hf, hf2(137);
+    CHECK(hf(strs[1]) == XXH3_64bits(strs[1].data(), strs[1].size()));
+    CHECK(hf2(strs[1]) == XXH3_64bits_withSeed(strs[1].data(), strs[1].size(), 137));
+
+    // Spans from each kind of string hash their bytes.
+    const std::vector<char> chars(strs[2].begin(), strs[2].end());
+    const std::string withnul("ab\0cd", 5);
+    CHECK(hf(chars) == hf(strs[2]));
+    CHECK(hf(strs[2].data()) == hf(strs[2]));
+    CHECK(hf(withnul) == hf(withnul.data(), 5) && hf(withnul) != hf("ab"));
+#if __cplusplus >= 201703L
+    CHECK(hf(std::string_view(strs[2])) == hf(strs[2]));
+#endif
+
+    // Batch hashing, for lengths around the prefetch distance and the block size
+    std::vector<hash::byte_span_t> spans(strs.begin(), strs.end());
+    std::vector<uint64_t> hashes(strs.size());
+    for(const size_t n: {size_t(0), size_t(1), size_t(7), size_t(8), size_t(9), size_t(65), strs.size()}) {
+        std::fill(hashes.begin(), hashes.end(), 0);
+        hf.hash_batch(strs.data(), hashes.data(), n);
+        for(size_t i = 0; i < n; ++i) CHECK(hashes[i] == hf(strs[i]));
+        hf2.hash_batch(spans.data(), hashes.data(), n);
+        for(size_t i = 0; i < n; ++i) CHECK(hashes[i] == hf2(strs[i]));
+    }
+
+    // add_strings matches inserting one string at a time, through add_batch for hll_t and add() otherwise.
+    hll::hll_t h1(12), h2(12);
+    hash::add_strings(h1, strs);
+    for(const auto &s: strs) h2.addh(s);
+    CHECK(h1 == h2);
+    CHECK(std::abs(h1.report() - strs.size()) < strs.size() * 0.1);
+    hll::hll_t h3(12);
+    hash::add_strings(h3, spans.data(), spans.size());
+    CHECK(h3 == h1);
+
+    bf::bf_t b1(16, 4, 137), b2(16, 4, 137);
+    hash::add_strings(b1, strs);
+    for(const auto &s: strs) b2.addh(s);
+    CHECK(b1.popcnt() == b2.popcnt());
+    for(const auto &s: strs) CHECK(b1.may_contain(hf(s)));
+
+    cm::ccm_t c1(16, 10, 4), c2(16, 10, 4);
+    hash::add_strings(c1, strs);
+    for(const auto &s: strs) c2.add(hf(s));
+    for(const auto &s: strs) CHECK(c1.est_count(hf(s)) == c2.est_count(hf(s)) && c1.est_count(hf(s)) > 0);
+
+    minhash::RangeMinHash<uint64_t> m1(128), m2(128);
+    hash::add_strings(m1, strs, hf2);
+    for(const auto &s: strs) m2.add(hf2(s));
+    CHECK(m1.finalize().jaccard_index(m2.finalize()) == 1.);
+    std::fprintf(stderr, "All string hashing tests passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -38,6 +38,102 @@ void kt_helper(void *data, long index, int tid) {
     for(std::uint64_t i(index * todo), e(std::min(((kt_data *)data)->n_, (index + 1) * todo)); i < e; hll.addh(i++));
 }
 
+bool test_batch(size_t lim) {
+    hll::hll_t t(BITS >> 1), tb(BITS >> 1), thb(BITS >> 1);
+    std::vector<std::uint64_t> vals(lim);
+    std::iota(vals.begin(), vals.end(), 0);
+    for(const auto v: vals) t.addh(v);
+    thb.addh_batch(vals);
+    for(auto &v: vals) v = tb.hash(v);
+    tb.add_batch(vals.data(), vals.size());
+    return t == tb && t == thb;
+}
+
+bool test_hist(size_t lim) {
+    hll::hll_t t(BITS >> 1);
+    hll::histhll_t ht(BITS >> 1);
+    for(size_t i = 0; i < lim; ++i) {
+        t.addh(i), ht.addh(i);
+        if((i & 1023) == 0 && (t.not_ready(), t.report()) != ht.report()) return false;
+    }
+    ht.addh_batch(std::vector<std::uint64_t>{1, 2, 3, uint64_t(lim) + 1});
+    for(const uint64_t v: {1, 2, 3}) t.addh(v);
+    t.addh(uint64_t(lim) + 1);
+    t.not_ready();
+    hll::histhll_t ht2(ht);
+    ht2 += hll::histhll_t(t);
+    return t == ht.as_hll() && ht2 == ht && ht.counts() == hll::detail::sum_counts(t.core()) && t.report() == ht.report();
+}
+
+bool test_shard(size_t lim, unsigned nthreads) {
+    hll::hll_t t(BITS >> 1);
+    hll::shardhll_t st(nthreads, BITS >> 1);
+    for(size_t i = 0; i < lim; t.addh(i++));
+    std::vector<std::thread> threads;
+    for(unsigned tid = 0; tid < nthreads; ++tid) {
+        threads.emplace_back([&st,lim,nthreads,tid]() {
+            for(size_t i = tid; i < lim; i += nthreads) st.addh(i, tid);
+        });
+    }
+    // Queries merge concurrently with the writers.
+    std::atomic<bool> done(false);
+    std::thread reader([&st,&done]() {while(!done.load()) st.report();});
+    for(auto &th: threads) th.join();
+    done.store(true);
+    reader.join();
+    st.write("shardtest.hll");
+    hll::hll_t read("shardtest.hll");
+    std::remove("shardtest.hll");
+    return st.finalize() == t && st.report() == t.report() && read == t;
+}
+
+bool test_joint(size_t lim) {
+    hll::hll_t t1(BITS >> 1), t2(BITS >> 1);
+    for(size_t i = 0; i < lim; ++i) t1.addh(i), t2.addh(i + lim / 2);
+    std::array<uint32_t, 64> c1{0}, c2{0}, cu{0}, ceq{0}, cg1{0}, cg2{0}, ju{0}, jeq{0}, jg1{0}, jg2{0};
+    hll::detail::joint_unroller().sum_arrays(t1.core(), t2.core(), c1, c2, cu, cg1, cg2, ceq);
+    hll::detail::joint_histogram_t jh;
+    jh.add(t1.data() + 1, t2.data() + 1, t1.size() - 1); // Unaligned, with a scalar tail
+    jh.add(t1.data(), t2.data(), 1);
+    jh.finalize(ju, jg1, jg2, jeq);
+    const auto withcards = hll::ertl_joint(t1, t2, hll::detail::ertl_card(t1), hll::detail::ertl_card(t2));
+    return cu == ju && cg1 == jg1 && cg2 == jg2 && ceq == jeq && withcards == hll::ertl_joint(t1, t2);
+}
+
+bool test_counts(size_t lim) {
+    hll::hll_t t1(BITS >> 1), t2(BITS >> 1);
+    for(size_t i = 0; i < lim; ++i) t1.addh(i), t2.addh(i + lim / 2);
+    std::array<uint32_t, 64> c{0}, cu{0};
+    for(size_t i = 0; i < t1.size(); ++i) ++c[t1.core()[i]], ++cu[std::max(t1.core()[i], t2.core()[i])];
+    hll::detail::byte_histogram_t<64> hist;
+    hist.add_max(t1.data() + 3, t2.data() + 3, t1.size() - 3); // Unaligned, with a scalar tail
+    hist.add_max(t1.data(), t2.data(), 3);
+    return c == hll::detail::sum_counts(t1.core()) && cu == hist.counts();
+}
+
+bool test_compress(size_t lim) {
+    // Folding registers must give exactly the sketch built at the smaller size from the same hashes.
+    for(const unsigned p: {4u, 8u, 14u, 20u}) {
+        hll::hll_t t(p);
+        for(size_t i = 0; i < lim; t.addh(i++));
+        std::vector<hll::hll_t> batch;
+        for(const unsigned new_p: {p, p - 1, p - 3, p - 6, p - 7, p - 10, 4u}) {
+            if(new_p > p || new_p < 4) continue;
+            hll::hll_t small(new_p);
+            for(size_t i = 0; i < lim; small.addh(i++));
+            hll::hll_t ip(t);
+            ip.compress_inplace(new_p);
+            if(!(t.compress(new_p) == small) || !(ip == small)) return false;
+            batch.push_back(t);
+            batch.push_back(t);
+            hll::compress_inplace(batch, new_p, 2);
+            for(const auto &b: batch) if(!(b == small)) return false;
+            batch.clear();
+        }
+    }
+    return true;
+}
+
 //using hll = namespace sketch::hll;
 
 /*
@@ -49,6 +145,32 @@ int main(int argc, char *argv[]) {
     mh::HyperMinHash<> mh(10, 10), mh2(12, 10);
     mh::HyperMinHash<> mh3(mh.p(), 10); mh3 += mh;
     mh.addh(uint64_t(1337));
+    for(const size_t lim: {0, 7, 1 << 10, (1 << 16) + 13}) {
+        if(!test_batch(lim)) {
+            std::fprintf(stderr, "Batch insertion does not match scalar insertion for %zu elements.\n", lim);
+            return EXIT_FAILURE;
+        }
+        if(!test_hist(lim)) {
+            std::fprintf(stderr, "Incrementally maintained histogram does not match registers for %zu elements.\n", lim);
+            return EXIT_FAILURE;
+        }
+        if(!test_counts(lim)) {
+            std::fprintf(stderr, "Register histograms do not match scalar counts for %zu elements.\n", lim);
+            return EXIT_FAILURE;
+        }
+        if(!test_compress(lim)) {
+            std::fprintf(stderr, "Compressed sketches do not match sketches built at the smaller size for %zu elements.\n", lim);
+            return EXIT_FAILURE;
+        }
+        if(!test_joint(lim)) {
+            std::fprintf(stderr, "Joint histograms do not match scalar counts for %zu elements.\n", lim);
+            return EXIT_FAILURE;
+        }
+        if(!test_shard(lim, 4)) {
+            std::fprintf(stderr, "Sharded insertion does not match scalar insertion for %zu elements.\n", lim);
+            return EXIT_FAILURE;
+        }
+    }
     std::vector<std::uint64_t> vals;
     for(char **p(argv + 1); *p; ++p) vals.push_back(strtoull(*p, 0, 10));
     if(vals.empty()) vals.push_back(1ull<<(BITS+1));
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "aesctr/wy.h"
+
+// Shared by the standalone tests in src/, each of which returns EXIT_FAILURE from main at the first failed check.
+#define CHECK(cond) do {if(!(cond)) {std::fprintf(stderr, "[%s:%d] Check failed: %s\n", __FILE__, __LINE__, #cond); return EXIT_FAILURE;}} while(0)
+
+namespace sketch {
+namespace test {
+
+// n pseudorandom 64-bit keys, reproducible from seed.
+static inline std::vector<uint64_t> random_keys(size_t n, uint64_t seed=13) {
+    wy::WyHash<uint64_t> gen(seed);
+    std::vector<uint64_t> ret(n);
+    for(auto &v: ret) v = gen();
+    return ret;
+}
+
+} // namespace test
+} // namespace sketch
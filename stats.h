@@ -0,0 +1,169 @@
+#ifndef SKETCH_STATS_H__
+#define SKETCH_STATS_H__
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sketch {
+namespace stats {
+
+// Process-wide, low-overhead counters for sketch hot paths.
+// Each thread increments its own cache-line-aligned block of counters without atomic read-modify-writes,
+// and snapshot() sums the blocks of live threads with the totals left behind by exited threads.
+// Collection is off by default and is toggled at runtime with enable(), so it can be turned on in a running service;
+// while disabled, instrumented paths pay one relaxed load and a predictable branch.
+// Define DISABLE_SKETCH_STATS to compile collection out entirely.
+// The HyperLogLog family (hll.h) records every counter and the rank histogram. Bloom filters (bf.h) and
+// count and count-min sketches (ccm.h) record inserts and merges only, so when they are in use,
+// update_rate() understates the HyperLogLogs' rate. Other sketches, such as the minhash family, record nothing.
+
+enum Counter: unsigned {
+    INSERTS,               // Elements inserted
+    REGISTER_UPDATES,      // Inserts which raised a register
+    CAS_RETRIES,           // Failed compare-and-swaps on contended registers
+    MERGES,                // Sketch unions
+    ESTIMATOR_ITERATIONS,  // Iterations of iterative estimators (e.g., the secant steps of Ertl's MLE)
+    NUM_COUNTERS
+};
+static constexpr const char *COUNTER_NAMES[] {
+    "inserts",
+    "register_updates",
+    "cas_retries",
+    "merges",
+    "estimator_iterations"
+};
+static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) == NUM_COUNTERS, "Every counter needs a name");
+static constexpr unsigned NUM_RANKS = 64;
+
+struct snapshot_t {
+    std::array<uint64_t, NUM_COUNTERS> counters{};
+    std::array<uint64_t, NUM_RANKS>    ranks{};    // Inserted ranks, to check for bias in insertion
+    uint64_t operator[](Counter c) const {return counters[c];}
+    // Fraction of inserts which changed a register. It falls as sketches saturate.
+    double update_rate() const {return counters[INSERTS] ? double(counters[REGISTER_UPDATES]) / counters[INSERTS]: 0.;}
+    // Failed compare-and-swaps per register update, a measure of contention.
+    double retry_rate() const {return counters[REGISTER_UPDATES] ? double(counters[CAS_RETRIES]) / counters[REGISTER_UPDATES]: 0.;}
+    snapshot_t &operator-=(const snapshot_t &o) {
+        for(unsigned i = 0; i < NUM_COUNTERS; ++i) counters[i] -= o.counters[i];
+        for(unsigned i = 0; i < NUM_RANKS; ++i) ranks[i] -= o.ranks[i];
+        return *this;
+    }
+    snapshot_t operator-(const snapshot_t &o) const {snapshot_t ret(*this); ret -= o; return ret;}
+    std::string to_string() const {
+        std::string ret;
+        for(unsigned i = 0; i < NUM_COUNTERS; ++i)
+            ret += COUNTER_NAMES[i], ret += ':', ret += std::to_string(counters[i]), ret += ';';
+        ret += "ranks:";
+        for(const auto r: ranks) ret += std::to_string(r), ret += ',';
+        ret.back() = '\n';
+        return ret;
+    }
+};
+
+namespace detail {
+
+struct alignas(64) thread_block_t {
+    // Only the owning thread writes, so increments are relaxed loads and stores rather than locked adds.
+    std::array<std::atomic<uint64_t>, NUM_COUNTERS> counters;
+    std::array<std::atomic<uint64_t>, NUM_RANKS>    ranks;
+    thread_block_t();
+    ~thread_block_t();
+    void accumulate(snapshot_t &s) const {
+        for(unsigned i = 0; i < NUM_COUNTERS; ++i) s.counters[i] += counters[i].load(std::memory_order_relaxed);
+        for(unsigned i = 0; i < NUM_RANKS; ++i) s.ranks[i] += ranks[i].load(std::memory_order_relaxed);
+    }
+    void zero() {
+        for(auto &c: counters) c.store(0, std::memory_order_relaxed);
+        for(auto &r: ranks) r.store(0, std::memory_order_relaxed);
+    }
+};
+
+struct registry_t {
+    std::mutex                     mut_;
+    std::vector<thread_block_t *>  blocks_;
+    snapshot_t                     retired_; // Totals of threads which have exited
+};
+inline registry_t &registry() {
+    static registry_t reg;
+    return reg;
+}
+inline thread_block_t::thread_block_t() {
+    zero();
+    auto &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mut_);
+    reg.blocks_.push_back(this);
+}
+inline thread_block_t::~thread_block_t() {
+    auto &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mut_);
+    accumulate(reg.retired_);
+    reg.blocks_.erase(std::find(reg.blocks_.begin(), reg.blocks_.end(), this));
+}
+inline thread_block_t &local() {
+    static thread_local thread_block_t block;
+    return block;
+}
+inline std::atomic<bool> &enabled_flag() {
+    static std::atomic<bool> flag(false);
+    return flag;
+}
+static inline void bump(std::atomic<uint64_t> &c, uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+} // namespace detail
+
+#ifndef DISABLE_SKETCH_STATS
+inline bool enabled() {return detail::enabled_flag().load(std::memory_order_relaxed);}
+#else
+static constexpr bool enabled() {return false;}
+#endif
+inline void enable(bool val=true) {detail::enabled_flag().store(val, std::memory_order_relaxed);}
+inline void disable() {enable(false);}
+
+// Increment counters of the calling thread. Callers check enabled() first, ideally once per batch.
+inline void add(Counter c, uint64_t n=1) {detail::bump(detail::local().counters[c], n);}
+inline void add_rank(unsigned rank, uint64_t n=1) {detail::bump(detail::local().ranks[rank], n);}
+// Records one insertion of a given rank, whether it raised its register, and how many compare-and-swaps failed.
+inline void add_insert(unsigned rank, bool updated, unsigned retries) {
+    auto &block = detail::local();
+    detail::bump(block.counters[INSERTS], 1);
+    detail::bump(block.counters[REGISTER_UPDATES], updated);
+    detail::bump(block.counters[CAS_RETRIES], retries);
+    detail::bump(block.ranks[rank], 1);
+}
+// Records n insertions of the given ranks, of which updates raised registers after retries failed compare-and-swaps.
+inline void add_inserts(const uint8_t *ranks, size_t n, uint64_t updates, uint64_t retries) {
+    auto &block = detail::local();
+    detail::bump(block.counters[INSERTS], n);
+    detail::bump(block.counters[REGISTER_UPDATES], updates);
+    detail::bump(block.counters[CAS_RETRIES], retries);
+    for(size_t i = 0; i < n; detail::bump(block.ranks[ranks[i++]], 1));
+}
+
+// Aggregates the counters of every thread.
+inline snapshot_t snapshot() {
+    snapshot_t ret;
+    auto &reg = detail::registry();
+    std::lock_guard<std::mutex> lock(reg.mut_);
+    ret = reg.retired_;
+    for(const auto block: reg.blocks_) block->accumulate(ret);
+    return ret;
+}
+// Zeroes all counters. Increments racing with a reset on other threads may survive it;
+// for exact intervals, take the difference of two snapshots instead.
+inline void reset() {
+    auto &reg = detail::registry();
+    std::lock_guard<std::mutex> lock(reg.mut_);
+    reg.retired_ = snapshot_t();
+    for(const auto block: reg.blocks_) block->zero();
+}
+
+} // namespace stats
+} // namespace sketch
+
+#endif /* SKETCH_STATS_H__ */
@@ -0,0 +1,78 @@
+#ifndef SKETCH_STRHASH_H__
+#define SKETCH_STRHASH_H__
+#include "common.h"
+#include "./xxHash/xxh3.h"
+#if __cplusplus >= 201703L
+#  include <string_view>
+#endif
+
+namespace sketch {
+namespace hash {
+
+// Byte-string ingestion: strings are hashed with XXH3 a block at a time and the hashes inserted with a sketch's add(),
+// so any sketch can consume strings directly, without a separate pass to hash them first.
+
+// A pointer and length, constructible from anything with data() and size() over bytes
+// (std::string, std::string_view, std::vector<char>, ...) and from null-terminated strings.
+struct byte_span_t {
+    const char *data_;
+    size_t      size_;
+    byte_span_t(const void *data, size_t size): data_(static_cast<const char *>(data)), size_(size) {}
+    byte_span_t(const char *s): byte_span_t(s, std::strlen(s)) {}
+    template<typename T, typename=typename std::enable_if<sizeof(*std::declval<const T &>().data()) == 1>::type>
+    byte_span_t(const T &s): byte_span_t(s.data(), s.size()) {}
+    const char *data() const {return data_;}
+    size_t size() const {return size_;}
+};
+
+struct XXH3Hasher {
+    uint64_t seed_;
+    XXH3Hasher(uint64_t seed=0): seed_(seed) {}
+    uint64_t operator()(const void *data, size_t len) const {return XXH3_64bits_withSeed(data, len, seed_);}
+    uint64_t operator()(byte_span_t s) const {return this->operator()(s.data(), s.size());}
+    // Hashes n strings into out. Strings are usually separate allocations, so the contents of each are
+    // prefetched a few strings ahead, overlapping their cache misses with hashing.
+    template<typename Str>
+    void hash_batch(const Str *strs, uint64_t *out, size_t n) const {
+        static constexpr size_t PREFETCH_DISTANCE = 8;
+        for(size_t i = 0; i < std::min(n, PREFETCH_DISTANCE); __builtin_prefetch(byte_span_t(strs[i++]).data()));
+        for(size_t i = 0; i < n; ++i) {
+            if(i + PREFETCH_DISTANCE < n) __builtin_prefetch(byte_span_t(strs[i + PREFETCH_DISTANCE]).data());
+            out[i] = this->operator()(byte_span_t(strs[i]));
+        }
+    }
+};
+
+namespace detail {
+static constexpr size_t STRING_BATCH_SIZE = 64;
+
+// Inserts a block of hashes, through add_batch where the sketch has one (e.g., hllbase_t) and add() otherwise.
+template<typename Sketch>
+INLINE auto add_hashes(Sketch &sketch, const uint64_t *hashes, size_t n, int) -> decltype(sketch.add_batch(hashes, n), void()) {
+    sketch.add_batch(hashes, n);
+}
+template<typename Sketch>
+INLINE void add_hashes(Sketch &sketch, const uint64_t *hashes, size_t n, long) {
+    for(size_t i = 0; i < n; sketch.add(hashes[i++]));
+}
+} // namespace detail
+
+// Hashes n strings with hf and inserts their hashes into sketch with its add().
+template<typename Sketch, typename Str, typename Hasher=XXH3Hasher>
+void add_strings(Sketch &sketch, const Str *strs, size_t n, const Hasher &hf=Hasher()) {
+    uint64_t buf[detail::STRING_BATCH_SIZE];
+    for(size_t i = 0; i < n; i += detail::STRING_BATCH_SIZE) {
+        const size_t nb = std::min(n - i, detail::STRING_BATCH_SIZE);
+        hf.hash_batch(strs + i, buf, nb);
+        detail::add_hashes(sketch, static_cast<const uint64_t *>(buf), nb, 0);
+    }
+}
+template<typename Sketch, typename Container, typename Hasher=XXH3Hasher>
+auto add_strings(Sketch &sketch, const Container &strs, const Hasher &hf=Hasher()) -> decltype(strs.data(), void()) {
+    add_strings(sketch, strs.data(), strs.size(), hf);
+}
+
+} // namespace hash
+} // namespace sketch
+
+#endif /* SKETCH_STRHASH_H__ */